@@ -0,0 +1,574 @@
+#include "balboa_capture.hpp"
+#include "balboa_messages.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace balboa;
+
+namespace
+{
+    const uint8_t FILE_MAGIC[8] = {'B', 'B', 'C', 'A', 'P', 0x01, 0x00, 0x00};
+    const uint8_t INDEX_MAGIC[4] = {'B', 'I', 'D', 'X'};
+    const uint8_t BLOCK_MARK = 'K';
+    const size_t BLOCK_HEADER = 1 + 4 + 8 + 2;
+    const size_t MAX_RECORD = 2 * (1 + 5) + 255;
+
+    enum RecordKind
+    {
+        KEY    = 0x00,
+        DELTA  = 0x40,
+        REPEAT = 0x80,
+        RUN    = 0xC0,
+        KIND_MASK = 0xC0,
+        SLOT_MASK = 0x07
+    };
+
+    void PutLE(uint8_t *out, uint64_t value, size_t bytes)
+    {
+        for (size_t i = 0; i < bytes; i++)
+        {
+            out[i] = (uint8_t)(value >> (8 * i));
+        }
+    }
+
+    uint64_t GetLE(const uint8_t *in, size_t bytes)
+    {
+        uint64_t value = 0;
+        for (size_t i = 0; i < bytes; i++)
+        {
+            value |= (uint64_t)in[i] << (8 * i);
+        }
+        return value;
+    }
+}
+
+/*****************************************************************
+**************************WRITER**********************************
+******************************************************************/
+
+bool CaptureWriter::Begin()
+{
+    _offset = 0;
+    _used = 0;
+    _records = 0;
+    _clock = 0;
+    _index.clear();
+
+    if (!_sink.Write(FILE_MAGIC, sizeof(FILE_MAGIC)))
+    {
+        return false;
+    }
+    _offset += sizeof(FILE_MAGIC);
+    return true;
+}
+
+void CaptureWriter::PutVarint(uint32_t value)
+{
+    while (value >= 0x80)
+    {
+        Put((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    Put((uint8_t)value);
+}
+
+bool CaptureWriter::Add(uint64_t timestamp_ms, const uint8_t *frame)
+{
+    if (frame[0] < 5)
+    {
+        return false;
+    }
+
+    // Seek() relies on blocks being in time order.
+    timestamp_ms = std::max(timestamp_ms, _clock);
+    _clock = timestamp_ms;
+
+    if (_records && (_used + MAX_RECORD > BLOCK_SIZE || _records >= UINT16_MAX - 1 ||
+                     timestamp_ms - _first > BLOCK_MAX_MS))
+    {
+        if (!Flush())
+        {
+            return false;
+        }
+    }
+
+    if (!_records)
+    {
+        _first = _last = timestamp_ms;
+        _used = BLOCK_HEADER;
+        _next_slot = 0;
+        _history_count = 0;
+        _run = 0;
+        for (Slot &slot : _slots)
+        {
+            slot.length = 0;
+        }
+    }
+
+    uint32_t dt = (uint32_t)std::min<uint64_t>(timestamp_ms - _last, UINT32_MAX);
+    _last = timestamp_ms;
+    Encode(dt, frame);
+    return true;
+}
+
+void CaptureWriter::PutRun()
+{
+    if (_run)
+    {
+        Put(RUN | (_run_period - 1));
+        PutVarint(_run);
+        _records++;
+        _run = 0;
+    }
+}
+
+void CaptureWriter::Remember(uint8_t slot, uint32_t dt)
+{
+    _history[_history_count % HISTORY] = {slot, dt};
+    _history_count++;
+}
+
+bool CaptureWriter::Repeats(uint8_t slot, uint32_t dt, uint8_t period) const
+{
+    if (_history_count < period)
+    {
+        return false;
+    }
+    const Record &record = _history[(_history_count - period) % HISTORY];
+    return record.slot == slot && record.dt == dt;
+}
+
+void CaptureWriter::Encode(uint32_t dt, const uint8_t *frame)
+{
+    // The crc is not stored, the reader recomputes it.
+    const uint8_t length = frame[0] - 1;
+
+    uint8_t slot = 0;
+    while (slot < SLOTS && !(_slots[slot].length && !memcmp(_slots[slot].frame + 1, frame + 1, 3)))
+    {
+        slot++;
+    }
+
+    if (slot < SLOTS && _slots[slot].length == length &&
+        !memcmp(_slots[slot].frame + 4, frame + 4, length - 4))
+    {
+        // Same content, so only the timing needs storing.  When the last
+        // `period` records replay with the same timing, extend a run.
+        if (_run && Repeats(slot, dt, _run_period))
+        {
+            _run++;
+            Remember(slot, dt);
+            return;
+        }
+        PutRun();
+
+        for (uint8_t period = 1; period <= HISTORY; period++)
+        {
+            if (Repeats(slot, dt, period))
+            {
+                _run = 1;
+                _run_period = period;
+                Remember(slot, dt);
+                return;
+            }
+        }
+
+        Put(REPEAT | slot);
+        PutVarint(dt);
+        _records++;
+        Remember(slot, dt);
+        return;
+    }
+
+    PutRun();
+
+    if (slot < SLOTS && _slots[slot].length == length)
+    {
+        uint8_t *previous = _slots[slot].frame;
+        size_t pos = 4;
+
+        Put(DELTA | slot);
+        PutVarint(dt);
+        while (pos < length)
+        {
+            size_t zeros = pos;
+            while (zeros < length && previous[zeros] == frame[zeros])
+            {
+                zeros++;
+            }
+            PutVarint((uint32_t)(zeros - pos));
+            pos = zeros;
+            if (pos == length)
+            {
+                break;
+            }
+
+            // A literal run ends at two equal bytes in a row or at 255.
+            size_t end = pos;
+            while (end < length && end - pos < 255 &&
+                   !(previous[end] == frame[end] && (end + 1 == length || previous[end + 1] == frame[end + 1])))
+            {
+                end++;
+            }
+            Put((uint8_t)(end - pos));
+            for (; pos < end; pos++)
+            {
+                Put(previous[pos] ^ frame[pos]);
+                previous[pos] = frame[pos];
+            }
+        }
+        _records++;
+        Remember(slot, dt);
+        return;
+    }
+
+    if (slot == SLOTS)
+    {
+        slot = _next_slot;
+        _next_slot = (_next_slot + 1) % SLOTS;
+    }
+
+    Put(KEY | slot);
+    PutVarint(dt);
+    for (size_t i = 0; i < length; i++)
+    {
+        Put(frame[i]);
+    }
+    _records++;
+
+    if (length <= SLOT_SIZE)
+    {
+        _slots[slot].length = length;
+        memcpy(_slots[slot].frame, frame, length);
+        Remember(slot, dt);
+    }
+    else
+    {
+        // Too big to keep, make sure no later record refers to it.
+        _slots[slot].length = 0;
+        Remember(SLOTS, dt);
+    }
+}
+
+bool CaptureWriter::Flush()
+{
+    PutRun();
+    if (!_records)
+    {
+        return true;
+    }
+
+    _block[0] = BLOCK_MARK;
+    PutLE(_block + 1, _used - BLOCK_HEADER, 4);
+    PutLE(_block + 5, _first, 8);
+    PutLE(_block + 13, _records, 2);
+
+    if (!_sink.Write(_block, _used))
+    {
+        return false;
+    }
+
+    if (_keep_index)
+    {
+        _index.push_back(_first);
+        _index.push_back(_offset);
+    }
+    _offset += _used;
+    _used = 0;
+    _records = 0;
+    return true;
+}
+
+bool CaptureWriter::Finish()
+{
+    if (!Flush())
+    {
+        return false;
+    }
+    if (!_keep_index)
+    {
+        return true;
+    }
+
+    uint8_t entry[16];
+    for (size_t i = 0; i < _index.size(); i += 2)
+    {
+        PutLE(entry, _index[i], 8);
+        PutLE(entry + 8, _index[i + 1], 8);
+        if (!_sink.Write(entry, sizeof(entry)))
+        {
+            return false;
+        }
+    }
+
+    PutLE(entry, _index.size() / 2, 4);
+    memcpy(entry + 4, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    if (!_sink.Write(entry, 8))
+    {
+        return false;
+    }
+    _offset += _index.size() * 8 + 8;
+    return true;
+}
+
+/*****************************************************************
+**************************READER**********************************
+******************************************************************/
+
+bool CaptureReader::Open(const uint8_t *data, size_t size)
+{
+    _data = data;
+    _size = size;
+    _blocks.clear();
+    _block = 0;
+    _pos = _end = 0;
+    _remaining = 0;
+    _pending = false;
+
+    if (size < sizeof(FILE_MAGIC) || memcmp(data, FILE_MAGIC, sizeof(FILE_MAGIC)))
+    {
+        return false;
+    }
+
+    size_t blocks_end = size;
+    if (size >= sizeof(FILE_MAGIC) + 8 && !memcmp(data + size - 4, INDEX_MAGIC, sizeof(INDEX_MAGIC)))
+    {
+        uint64_t count = GetLE(data + size - 8, 4);
+        if (count * 16 + 8 <= size - sizeof(FILE_MAGIC))
+        {
+            const uint8_t *entry = data + size - 8 - count * 16;
+            for (uint64_t i = 0; i < count; i++, entry += 16)
+            {
+                _blocks.push_back({GetLE(entry, 8), GetLE(entry + 8, 8)});
+            }
+            return EnterBlock(0) || _blocks.empty();
+        }
+    }
+
+    // No index, the writer did not finish; walk the block headers.
+    size_t offset = sizeof(FILE_MAGIC);
+    while (offset + BLOCK_HEADER <= blocks_end && data[offset] == BLOCK_MARK)
+    {
+        uint64_t payload = GetLE(data + offset + 1, 4);
+        if (offset + BLOCK_HEADER + payload > blocks_end)
+        {
+            break;
+        }
+        _blocks.push_back({GetLE(data + offset + 5, 8), offset});
+        offset += BLOCK_HEADER + payload;
+    }
+    return EnterBlock(0) || _blocks.empty();
+}
+
+bool CaptureReader::EnterBlock(size_t block)
+{
+    _block = block;
+    _remaining = 0;
+    _run = 0;
+    if (block >= _blocks.size())
+    {
+        return false;
+    }
+
+    size_t offset = _blocks[block].offset;
+    if (offset + BLOCK_HEADER > _size || _data[offset] != BLOCK_MARK)
+    {
+        return false;
+    }
+
+    uint64_t payload = GetLE(_data + offset + 1, 4);
+    if (offset + BLOCK_HEADER + payload > _size)
+    {
+        return false;
+    }
+
+    _time = GetLE(_data + offset + 5, 8);
+    _remaining = (uint16_t)GetLE(_data + offset + 13, 2);
+    _run = 0;
+    _history_count = 0;
+    _pos = offset + BLOCK_HEADER;
+    _end = _pos + payload;
+    for (Slot &slot : _slots)
+    {
+        slot.length = 0;
+    }
+    return true;
+}
+
+bool CaptureReader::ReadVarint(uint32_t &value)
+{
+    value = 0;
+    for (uint8_t shift = 0; shift < 35 && _pos < _end; shift += 7)
+    {
+        uint8_t byte = _data[_pos++];
+        value |= (uint32_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CaptureReader::Seek(uint64_t timestamp_ms)
+{
+    // Start in the last block that begins strictly before the target: several
+    // blocks may begin at the target itself and all of them can hold matches,
+    // as may the tail of the block before them.
+    auto it = std::lower_bound(_blocks.begin(), _blocks.end(), timestamp_ms,
+                               [](const Block &b, uint64_t t) { return b.first < t; });
+    size_t block = it == _blocks.begin() ? 0 : (size_t)(it - _blocks.begin()) - 1;
+
+    if (!EnterBlock(block))
+    {
+        return false;
+    }
+
+    // Decode forward and hold on to the first frame not before the target.
+    _pending = false;
+    do
+    {
+        if (!Next(_pending_time, _pending_frame))
+        {
+            return false;
+        }
+    } while (_pending_time < timestamp_ms);
+
+    _pending = true;
+    return true;
+}
+
+bool CaptureReader::Next(uint64_t &timestamp_ms, uint8_t *frame)
+{
+    if (_pending)
+    {
+        _pending = false;
+        timestamp_ms = _pending_time;
+        memcpy(frame, _pending_frame, _pending_frame[0]);
+        return true;
+    }
+
+    if (_run)
+    {
+        const Record &record = _history[(_history_count - _run_period) % CaptureWriter::HISTORY];
+        _run--;
+        return Emit(record.slot, record.dt, timestamp_ms, frame);
+    }
+
+    while (!_remaining)
+    {
+        if (!EnterBlock(_block + 1))
+        {
+            return false;
+        }
+    }
+
+    if (_pos >= _end)
+    {
+        _remaining = 0;
+        return false;
+    }
+    _remaining--;
+
+    uint8_t tag = _data[_pos++];
+    uint8_t index = tag & SLOT_MASK;
+    Slot &slot = _slots[index];
+    uint32_t dt = 0;
+
+    if ((tag & KIND_MASK) == RUN)
+    {
+        uint32_t count;
+        if (!ReadVarint(count) || !count || _history_count <= index)
+        {
+            _remaining = 0;
+            return false;
+        }
+        _run = count;
+        _run_period = index + 1;
+        return Next(timestamp_ms, frame);
+    }
+
+    if (!ReadVarint(dt))
+    {
+        _remaining = 0;
+        return false;
+    }
+
+    switch (tag & KIND_MASK)
+    {
+    case KEY:
+    {
+        uint8_t length = _pos < _end ? _data[_pos] - 1 : 0;
+        if (length < 4 || _pos + length > _end)
+        {
+            _remaining = 0;
+            return false;
+        }
+        memcpy(slot.frame, _data + _pos, length);
+        slot.length = length;
+        _pos += length;
+        break;
+    }
+
+    case DELTA:
+    {
+        size_t pos = 4;
+        while (slot.length && pos < slot.length)
+        {
+            uint32_t zeros;
+            if (!ReadVarint(zeros))
+            {
+                _remaining = 0;
+                return false;
+            }
+            pos += zeros;
+            if (pos >= slot.length)
+            {
+                break;
+            }
+
+            uint8_t count = _pos < _end ? _data[_pos++] : 0;
+            if (!count || pos + count > slot.length || _pos + count > _end)
+            {
+                _remaining = 0;
+                return false;
+            }
+            for (; count; count--)
+            {
+                slot.frame[pos++] ^= _data[_pos++];
+            }
+        }
+        break;
+    }
+
+    case REPEAT:
+        break;
+
+    default:
+        _remaining = 0;
+        return false;
+    }
+
+    return Emit(index, dt, timestamp_ms, frame);
+}
+
+bool CaptureReader::Emit(uint8_t index, uint32_t dt, uint64_t &timestamp_ms, uint8_t *frame)
+{
+    _history[_history_count % CaptureWriter::HISTORY] = {index, dt};
+    _history_count++;
+    _time += dt;
+
+    if (!_slots[index].length)
+    {
+        _remaining = 0;
+        _run = 0;
+        return false;
+    }
+
+    const Slot &slot = _slots[index];
+    memcpy(frame, slot.frame, slot.length);
+    frame[slot.length] = CalcCRC(frame, slot.length);
+    timestamp_ms = _time;
+    return true;
+}
@@ -0,0 +1,172 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Compact long-term bus capture container.
+ *
+ * A capture is a file header followed by independent blocks and, if the
+ * writer kept one and was finished, a block index:
+ *
+ *   "BBCAP" version reserved[2]
+ *   block*     'K' payload_size:u32 first_timestamp:u64 records:u16 records...
+ *   index      (first_timestamp:u64 offset:u64)* count:u32 "BIDX"
+ *
+ * Frames are stored without prefix, suffix and crc (the crc is recomputed on
+ * read).  Every frame is encoded against the previous frame with the same
+ * header_type in the same block, so a block is a keyframe boundary and can be
+ * decoded on its own.  A record is a tag, holding the kind and the slot (one
+ * per header_type seen in the block), followed by
+ *
+ *   KEY     dt_ms:varint length type[3] payload...   full frame, (re)defines the slot
+ *   DELTA   dt_ms:varint (zero_run:varint count:u8 xor[count])* [zero_run:varint]
+ *   REPEAT  dt_ms:varint                             identical to the slot
+ *   RUN     count:varint
+ *
+ * For RUN the slot bits hold period - 1: the next `count` frames replay the
+ * (slot, dt) of the frame `period` frames back, content unchanged.  The bus
+ * cycle of Status plus polls collapses to a few bytes this way.
+ *
+ * All integers are little endian.
+ */
+namespace balboa
+{
+    class CaptureSink
+    {
+    public:
+        virtual ~CaptureSink() = default;
+        virtual bool Write(const uint8_t *data, size_t length) = 0;
+    };
+
+    class CaptureWriter
+    {
+    public:
+        static const size_t BLOCK_SIZE = 4096;
+        static const uint32_t BLOCK_MAX_MS = 60000;
+        static const uint8_t SLOTS = 8;
+        static const uint8_t SLOT_SIZE = 128;
+        static const uint8_t HISTORY = 8;
+
+        /**
+         * With `index` every block position is kept in RAM (16 bytes per
+         * block) for the index Finish() writes.  Leave it off when recording
+         * without end, e.g. on the device; readers then walk the block headers.
+         */
+        explicit CaptureWriter(CaptureSink &sink, bool index = false) : _sink(sink), _keep_index(index) {}
+
+        bool Begin();
+        /**
+         * `frame` starts at the length byte and holds frame[0] bytes, i.e.
+         * everything between the prefix and the suffix, crc included.
+         * A timestamp earlier than the previous one (a clock step) is
+         * clamped to it, so blocks stay in time order.  Frames then keep
+         * that timestamp with dt 0 until the clock catches up, for as long
+         * as the step was: their spacing is lost, their order is not.
+         */
+        bool Add(uint64_t timestamp_ms, const uint8_t *frame);
+        bool Flush();
+        bool Finish();
+
+        uint64_t written() const { return _offset; }
+
+    private:
+        friend class CaptureReader;
+
+        struct Slot
+        {
+            uint8_t length;
+            uint8_t frame[SLOT_SIZE];
+        };
+
+        struct Record
+        {
+            uint8_t slot;
+            uint32_t dt;
+        };
+
+        void Encode(uint32_t dt, const uint8_t *frame);
+        void Put(uint8_t value) { _block[_used++] = value; }
+        void PutVarint(uint32_t value);
+        void PutRun();
+        void Remember(uint8_t slot, uint32_t dt);
+        bool Repeats(uint8_t slot, uint32_t dt, uint8_t period) const;
+
+        CaptureSink &_sink;
+        const bool _keep_index;
+        uint64_t _offset = 0;
+        uint64_t _clock = 0; // latest timestamp added
+        uint64_t _first = 0;
+        uint64_t _last = 0;
+        uint16_t _records = 0;
+        size_t _used = 0;
+        uint8_t _next_slot = 0;
+        uint32_t _run = 0;
+        uint8_t _run_period = 0;
+        uint32_t _history_count = 0;
+        Record _history[HISTORY];
+        Slot _slots[SLOTS];
+        uint8_t _block[BLOCK_SIZE];
+        std::vector<uint64_t> _index; // first timestamp, offset pairs
+    };
+
+    class CaptureReader
+    {
+    public:
+        /**
+         * `data` must stay valid while the reader is used, typically an
+         * mmapped capture.  Without a trailing index the blocks are walked.
+         */
+        bool Open(const uint8_t *data, size_t size);
+
+        size_t blocks() const { return _blocks.size(); }
+
+        /**
+         * Positions the reader at the first frame with a timestamp not
+         * earlier than `timestamp_ms`.  O(log blocks) plus one partial block.
+         */
+        bool Seek(uint64_t timestamp_ms);
+
+        /**
+         * Writes the frame (length byte through crc) to `frame`, which must
+         * hold 256 bytes.  Returns false at the end of the capture.
+         */
+        bool Next(uint64_t &timestamp_ms, uint8_t *frame);
+
+    private:
+        struct Block
+        {
+            uint64_t first;
+            uint64_t offset;
+        };
+
+        struct Slot
+        {
+            uint8_t length;
+            uint8_t frame[256];
+        };
+
+        typedef CaptureWriter::Record Record;
+
+        bool EnterBlock(size_t block);
+        bool ReadVarint(uint32_t &value);
+        bool Emit(uint8_t index, uint32_t dt, uint64_t &timestamp_ms, uint8_t *frame);
+
+        const uint8_t *_data = nullptr;
+        size_t _size = 0;
+        std::vector<Block> _blocks;
+        size_t _block = 0;
+        size_t _pos = 0;
+        size_t _end = 0;
+        uint16_t _remaining = 0;
+        uint64_t _time = 0;
+        uint32_t _run = 0;
+        uint8_t _run_period = 0;
+        uint32_t _history_count = 0;
+        Record _history[CaptureWriter::HISTORY];
+        bool _pending = false;
+        uint64_t _pending_time = 0;
+        uint8_t _pending_frame[256];
+        Slot _slots[CaptureWriter::SLOTS];
+    };
+};
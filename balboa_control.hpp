@@ -1,21 +1,473 @@
 #pragma once
+#include <memory>
 #include "esphome.h"
+#include "balboa_energy.hpp"
+#include "balboa_fault_log.hpp"
+#include "balboa_filter.hpp"
 #include "balboa_messages.hpp"
+#include "balboa_parser.hpp"
+#include "balboa_transport.hpp"
 
 namespace balboa
 {
 
-class BalboaSpa : public Component {
+/// The spa bus on an ESPHome UART.  The UART buffers writes itself.
+class UartTransport : public Transport, public uart::UARTDevice {
  public:
+  explicit UartTransport(uart::UARTComponent *parent) : UARTDevice(parent) {}
+
+  size_t Read(uint8_t *data, size_t length) override {
+    length = std::min<size_t>(this->available(), length);
+    return length && this->read_array(data, length) ? length : 0;
+  }
+  bool Write(const uint8_t *data, size_t length) override {
+    this->write_array(data, length);
+    return true;
+  }
+};
+
+/**
+ * One spa on one UART, or on a TCP link to its Wi-Fi module.  Several
+ * instances can run side by side, the parsing and dispatch tables are
+ * shared.  An instance is about 480 bytes on a 64-bit host, less on the
+ * ESP: parser and TX queue about 120, RX buffer 64, last status 24, the
+ * rest id, calendar and clock callbacks and bookkeeping.  Energy accounting
+ * and the fault log are allocated only when enabled.
+ *
+ * `id` keys the energy and fault history saved in flash.  With more than
+ * one spa give each a stable id of its own (e.g. its YAML id), so that
+ * reordering them does not swap their histories.
+ */
+class BalboaSpa : public Component, public MessageHandler {
+ public:
+  explicit BalboaSpa(uart::UARTComponent *parent, const std::string &id = DEFAULT_ID)
+      : uart_(parent), transport_(&this->uart_), id_(id) {
+    instances_++;
+  }
+  /// `transport` must outlive the component, e.g. a TcpTransport.
+  explicit BalboaSpa(Transport *transport, const std::string &id = DEFAULT_ID)
+      : uart_(nullptr), transport_(transport), id_(id) {
+    instances_++;
+  }
+
   void setup() override {
     // This will be called by App.setup()
-    Message<ConfigRequest> message;
+    ConfigRequest::data_type data;
+    this->send<ConfigRequest>(data);
+    this->request_filter_cycles_();
 
-    ConfigRequest::SetPayload(true, message._data);
+    if (instances_ > 1 && this->id_ == DEFAULT_ID) {
+      ESP_LOGW("balboa", "several spas share the id '%s', their saved history will mix", DEFAULT_ID);
+    }
 
+    // The ESP8266 keeps all in-flash preferences in about 512 bytes, see
+    // save_pref_() for what happens when they do not fit.
+    if (this->energy_) {
+      this->energy_pref_ = global_preferences->make_preference<EnergyMeter::State>(
+          fnv1_hash("balboa_energy_" + this->id_), true);
+      this->energy_pref_.load(&this->energy_->state());
+      for (uint8_t p = 0; p < EnergyMeter::PERIODS; p++) {
+        this->spa_calendar_.period[p] = this->energy_->current((EnergyMeter::Period) p).key;
+      }
+    }
+
+    if (this->faults_) {
+      this->faults_pref_ = global_preferences->make_preference<FaultLogIndex::Stored>(
+          fnv1_hash("balboa_faults_" + this->id_), true);
+      this->faults_pref_.load(&this->faults_->stored());
+      this->faults_->Loaded();
+    }
   }
   void loop() override {
     // This will be called by App.loop()
+    // Work is cut in small resumable steps; whatever does not fit in the
+    // budget carries over to the next call in the same order.
+    const uint32_t start = micros();
+    bool more;
+
+    do {
+      more = this->step_();
+    } while (more && micros() - start < this->loop_budget_us_);
+
+    const uint32_t elapsed = micros() - start;
+    if (more) {
+      this->loop_stats_.carried_over++;
+    }
+    if (elapsed > this->loop_budget_us_) {
+      this->loop_stats_.overruns++;
+      // Only a new worst case is logged, the counter has the rest.
+      if (elapsed > this->loop_stats_.max_us) {
+        ESP_LOGW("balboa", "loop took %u us, budget %u us (stage %u)", (unsigned) elapsed,
+                 (unsigned) this->loop_budget_us_, (unsigned) this->stage_);
+      }
+    }
+    this->loop_stats_.max_us = std::max(this->loop_stats_.max_us, elapsed);
+  }
+  void on_shutdown() override {
+    if (this->energy_ && this->energy_->dirty()) {
+      this->save_energy_();
+    }
+  }
+
+  template<class MS> bool send(const typename MS::data_type &data) { return this->tx_.template Push<MS>(data); }
+
+  bool has_status() const { return this->has_status_; }
+  const Status::data_type &status() const { return this->status_; }
+
+  /**
+   * Turns on duty-cycle and energy accounting, saved in flash under `id`.
+   * Call before setup().  Costs about 470 bytes of RAM and 180 of flash.
+   */
+  void enable_energy() {
+    if (!this->energy_) {
+      this->energy_.reset(new EnergyMeter());
+    }
+  }
+  /// Power draw of `device` at `level`, 1 based; see EnergyMeter::MAX_LEVEL for the levels.  Implies enable_energy().
+  void set_device_watts(EnergyMeter::Device device, uint8_t level, uint16_t watts) {
+    this->enable_energy();
+    this->energy_->SetWatts(device, level, watts);
+  }
+  /// Flash is written at most this often, plus once on shutdown.
+  void set_energy_save_interval(uint32_t interval_ms) { this->energy_save_interval_ms_ = interval_ms; }
+  /**
+   * Supplies hour/day/month numbers, e.g. from an SNTP time component.
+   * Without it hours and days follow the spa clock, including corrections
+   * made to it, and the month bucket never rolls over.  The day must count
+   * local days since 1970-01-01, the fault log is pinned to it.
+   */
+  void set_calendar(std::function<bool(EnergyMeter::Calendar &)> &&calendar) { this->calendar_ = std::move(calendar); }
+  /// Null unless energy accounting is on.
+  const EnergyMeter *energy() const { return this->energy_.get(); }
+
+  /**
+   * Reference wall clock, e.g. from an SNTP time component.  The spa clock
+   * is only set when it is unset or drifted by max_clock_drift minutes.
+   */
+  void set_clock(std::function<bool(uint8_t &hour, uint8_t &minute)> &&clock) { this->clock_ = std::move(clock); }
+  void set_max_clock_drift(uint8_t minutes) { this->max_clock_drift_ = minutes; }
+
+  bool is_filtering() const { return this->status_.filter1_running || this->status_.filter2_running; }
+  /// Minutes until the next filter cycle starts, false if not known yet.
+  bool next_filter_run(uint16_t &minutes_until, FilterSchedule::Filter &filter) const {
+    if (!this->has_status_ || !this->filters_.valid()) {
+      return false;
+    }
+    return this->filters_.Next(FilterSchedule::MinuteOfDay(this->status_), minutes_until, filter);
+  }
+  const FilterSchedule &filter_schedule() const { return this->filters_; }
+
+  /**
+   * Turns on the fault log index, saved in flash under `id`.  Call before
+   * setup().  Costs about 220 bytes of RAM and 193 of flash.
+   */
+  void enable_fault_log() {
+    if (!this->faults_) {
+      this->faults_.reset(new FaultLogIndex());
+    }
+  }
+  /**
+   * Pulls the whole controller fault log, one request per entry, into
+   * fault_log(); entries already indexed are not stored again.  Needs
+   * enable_fault_log() and set_calendar(), the spa clock alone cannot date
+   * entries across reboots or spas.  Returns false when it cannot run.
+   */
+  bool request_fault_log() {
+    uint32_t day;
+    if (!this->faults_ || !this->fault_day_(day)) {
+      ESP_LOGW("balboa", "fault log of spa '%s' needs enabling, a calendar and a status first", this->id_.c_str());
+      return false;
+    }
+    this->request_fault_entry_(0);
+    return true;
+  }
+  /// Null unless the fault log is on.
+  const FaultLogIndex *fault_log() const { return this->faults_.get(); }
+  /// Now in FaultLogIndex::Entry::minute units, false without a calendar.
+  bool fault_log_now(uint32_t &minute) const {
+    uint32_t day;
+    if (!this->fault_day_(day)) {
+      return false;
+    }
+    minute = day * FilterSchedule::MINUTES_PER_DAY + FilterSchedule::MinuteOfDay(this->status_);
+    return true;
+  }
+
+  struct LoopStats {
+    uint32_t overruns;      ///< loop() calls that took longer than the budget
+    uint32_t carried_over;  ///< loop() calls that left work for the next one
+    uint32_t max_us;
+  };
+  /// Time loop() may spend per call; one step may still run over it.
+  void set_loop_budget(uint32_t budget_us) { this->loop_budget_us_ = budget_us; }
+  const LoopStats &loop_stats() const { return this->loop_stats_; }
+
+ protected:
+  enum Stage : uint8_t { STAGE_RX, STAGE_PARSE, STAGE_RECONCILE, STAGE_TX, STAGE_PERSIST };
+
+  static constexpr uint8_t RX_CHUNK = 64;
+  static constexpr uint8_t PARSE_SLICE = 16;
+  static constexpr uint8_t RX_CHUNKS_PER_CYCLE = 8;
+  static constexpr uint32_t FILTER_RETRY_MIN_MS = 60 * 1000;
+  static constexpr uint32_t FILTER_RETRY_MAX_MS = 24 * 60 * 60 * 1000;
+
+  /// Runs one bounded step, returns false when a full cycle completed.
+  bool step_() {
+    switch (this->stage_) {
+      case STAGE_RX:
+        this->rx_pos_ = 0;
+        this->rx_used_ = 0;
+        if (this->rx_chunks_ < RX_CHUNKS_PER_CYCLE) {
+          this->rx_used_ = this->transport_->Read(this->rx_, sizeof(this->rx_));
+        }
+        if (this->rx_used_) {
+          this->rx_chunks_++;
+          this->stage_ = STAGE_PARSE;
+        } else {
+          this->rx_chunks_ = 0;
+          this->stage_ = STAGE_RECONCILE;
+        }
+        return true;
+
+      case STAGE_PARSE: {
+        // Frames are dispatched from inside Feed().
+        uint8_t slice = std::min<uint8_t>(PARSE_SLICE, this->rx_used_ - this->rx_pos_);
+        this->parser_.Feed(this->rx_ + this->rx_pos_, slice, *this);
+        this->rx_pos_ += slice;
+        if (this->rx_pos_ == this->rx_used_) {
+          this->stage_ = STAGE_RX;
+        }
+        return true;
+      }
+
+      case STAGE_RECONCILE:
+        if (this->status_pending_) {
+          this->status_pending_ = false;
+          if (!this->filters_.Check(this->status_)) {
+            this->request_filter_cycles_();
+          }
+          this->reconcile_clock_(this->status_);
+        }
+        this->stage_ = STAGE_TX;
+        return true;
+
+      case STAGE_TX:
+        // Point to point links do not wait for a ReadyToSend.
+        if (!this->transport_->needs_clear_to_send()) {
+          while (!this->tx_.empty() && this->transport_->connected() && this->send_next_()) {
+          }
+        }
+        this->transport_->Flush();
+        this->stage_ = STAGE_PERSIST;
+        return true;
+
+      case STAGE_PERSIST:
+      default:
+        if (this->energy_ && this->energy_->dirty() &&
+            millis() - this->energy_saved_ms_ >= this->energy_save_interval_ms_) {
+          this->save_energy_();
+        }
+        // New faults are rare, save them as they come.
+        if (this->faults_ && this->faults_->dirty()) {
+          this->save_pref_(this->faults_pref_, this->faults_->stored(), "fault log");
+          this->faults_->clean();
+        }
+        this->stage_ = STAGE_RX;
+        return false;
+    }
   }
+
+  void OnReadyToSend(const ReadyToSend::data_type &) override {
+    if (this->transport_->needs_clear_to_send()) {
+      this->send_next_();
+    }
+  }
+
+  bool send_next_() {
+    uint8_t size;
+    const uint8_t *frame = this->tx_.Front(size);
+
+    if (!frame || !this->transport_->Write(frame, size)) {
+      return false;
+    }
+    this->tx_.Pop();
+    return true;
+  }
+  void OnStatus(const Status::data_type &data) override {
+    if (this->energy_) {
+      EnergyMeter::Calendar calendar;
+      if (!this->calendar_ || !this->calendar_(calendar)) {
+        this->follow_spa_clock_(data);
+        calendar = this->spa_calendar_;
+      }
+      this->energy_->Update(millis(), calendar, data);
+    }
+
+    // Schedule and clock checks only need the latest, see STAGE_RECONCILE.
+    this->status_ = data;
+    this->has_status_ = true;
+    this->status_pending_ = true;
+  }
+  void OnFilterCycles(const FilterCyclesResponse::data_type &data) override {
+    // The same cycles again: the spa does not follow them to the minute
+    // (e.g. it filters on while heating), polling faster will not help.
+    if (this->filters_.Set(data)) {
+      this->filters_retry_ms_ = FILTER_RETRY_MIN_MS;
+    } else {
+      this->filters_retry_ms_ = std::min(this->filters_retry_ms_ * 2, FILTER_RETRY_MAX_MS);
+    }
+  }
+  void OnFaultLog(const FaultLogResponse::data_type &data) override {
+    uint32_t day;
+    if (!this->faults_ || !this->fault_day_(day)) {
+      return;
+    }
+    this->faults_->Add(data, day, FilterSchedule::MinuteOfDay(this->status_));
+    if (data.entry_number + 1 < data.fault_count) {
+      this->request_fault_entry_(data.entry_number + 1);
+    }
+  }
+
+  /**
+   * Counts minutes on the spa clock.  A clock set, ours or from the panel,
+   * moves the count either way, but hour and day numbers only go up: setting
+   * the clock back across midnight must not count that midnight twice.
+   */
+  void follow_spa_clock_(const Status::data_type &data) {
+    const uint32_t per_day = FilterSchedule::MINUTES_PER_DAY;
+    if (!this->has_status_) {
+      this->spa_minute_ = this->spa_calendar_.period[EnergyMeter::DAY] * per_day + FilterSchedule::MinuteOfDay(data);
+    } else {
+      int16_t step = FilterSchedule::Drift(data, this->status_.hour, this->status_.minute);
+      this->spa_minute_ = step < 0 && (uint32_t) -step > this->spa_minute_ ? 0 : this->spa_minute_ + step;
+    }
+    uint32_t *period = this->spa_calendar_.period;
+    period[EnergyMeter::HOUR] = std::max<uint32_t>(period[EnergyMeter::HOUR], this->spa_minute_ / 60);
+    period[EnergyMeter::DAY] = std::max<uint32_t>(period[EnergyMeter::DAY], this->spa_minute_ / per_day);
+  }
+
+  void request_fault_entry_(uint8_t entry) {
+    SettingsRequest::data_type data;
+    SettingsRequest::SetSettingsType(SettingsRequest::FAULT_LOG_REQUEST, data);
+    data.payload[1] = entry;
+    this->send<SettingsRequest>(data);
+  }
+
+  /**
+   * Day number the spa clock is on.  Fault entries are relative to the spa
+   * clock, so near midnight a spa running fast or slow is on the day next
+   * to the calendar's; set_clock() tells which.
+   */
+  bool fault_day_(uint32_t &day) const {
+    EnergyMeter::Calendar calendar;
+    if (!this->has_status_ || !this->calendar_ || !this->calendar_(calendar)) {
+      return false;
+    }
+    day = calendar.period[EnergyMeter::DAY];
+    uint8_t hour, minute;
+    if (this->clock_ && this->clock_(hour, minute)) {
+      int16_t spa = hour * 60 + minute + FilterSchedule::Drift(this->status_, hour, minute);
+      if (spa < 0) {
+        day--;
+      } else if (spa >= FilterSchedule::MINUTES_PER_DAY) {
+        day++;
+      }
+    }
+    return true;
+  }
+
+  void request_filter_cycles_() {
+    // Only when the schedule is missing or stale, at most once a minute,
+    // backing off to once a day while the spa keeps sending the same one.
+    uint32_t now = millis();
+    if (this->filters_requested_ && now - this->filters_requested_ms_ < this->filters_retry_ms_) {
+      return;
+    }
+    SettingsRequest::data_type data;
+    SettingsRequest::SetSettingsType(SettingsRequest::FILTER_CYCLES_REQUEST, data);
+    if (this->send<SettingsRequest>(data)) {
+      this->filters_requested_ = true;
+      this->filters_requested_ms_ = now;
+    }
+  }
+
+  void reconcile_clock_(const Status::data_type &data) {
+    SetTimeRequest::SpaTime time;
+    uint32_t now = millis();
+    if (!this->clock_ || !this->clock_(time.hour, time.minute) ||
+        (this->time_set_ && now - this->time_set_ms_ < 10 * 60 * 1000)) {
+      return;
+    }
+
+    int16_t drift = FilterSchedule::Drift(data, time.hour, time.minute);
+    if (!data.time_unset && drift < this->max_clock_drift_ && drift > -this->max_clock_drift_) {
+      return;
+    }
+
+    SetTimeRequest::data_type request;
+    time.display_as_24hr = data.time_format;
+    SetTimeRequest::SetTime(time, request);
+    if (this->send<SetTimeRequest>(request)) {
+      this->time_set_ = true;
+      this->time_set_ms_ = now;
+    }
+  }
+
+  void save_energy_() {
+    this->save_pref_(this->energy_pref_, this->energy_->state(), "energy");
+    this->energy_->clean();
+    this->energy_saved_ms_ = millis();
+  }
+
+  /// A preference that got no flash slot refuses every save; say so instead of losing it quietly.
+  template<class T> void save_pref_(ESPPreferenceObject &pref, const T &value, const char *what) {
+    if (!pref.save(&value)) {
+      ESP_LOGW("balboa", "%s of spa '%s' not saved (%u bytes), flash preferences full?", what, this->id_.c_str(),
+               (unsigned) sizeof(T));
+    }
+  }
+
+  UartTransport uart_;
+  Transport *transport_;
+
+  static constexpr const char *DEFAULT_ID = "spa";
+  static uint8_t instances_;
+  const std::string id_;
+
+  FrameParser parser_;
+  TxQueue tx_;
+  Status::data_type status_{};
+  bool has_status_{false};
+  bool status_pending_{false};
+
+  Stage stage_{STAGE_RX};
+  uint8_t rx_[RX_CHUNK];
+  uint8_t rx_pos_{0};
+  uint8_t rx_used_{0};
+  uint8_t rx_chunks_{0};
+  uint32_t loop_budget_us_{2000};
+  LoopStats loop_stats_{};
+
+  std::unique_ptr<EnergyMeter> energy_;
+  EnergyMeter::Calendar spa_calendar_{};
+  uint32_t spa_minute_{0};
+  std::function<bool(EnergyMeter::Calendar &)> calendar_;
+  ESPPreferenceObject energy_pref_;
+  uint32_t energy_saved_ms_{0};
+  uint32_t energy_save_interval_ms_{15 * 60 * 1000};
+
+  std::unique_ptr<FaultLogIndex> faults_;
+  ESPPreferenceObject faults_pref_;
+
+  FilterSchedule filters_;
+  bool filters_requested_{false};
+  uint32_t filters_requested_ms_{0};
+  uint32_t filters_retry_ms_{FILTER_RETRY_MIN_MS};
+  std::function<bool(uint8_t &, uint8_t &)> clock_;
+  uint8_t max_clock_drift_{2};
+  bool time_set_{false};
+  uint32_t time_set_ms_{0};
+};
+
+inline uint8_t BalboaSpa::instances_ = 0;
 };
-};
\ No newline at end of file
@@ -0,0 +1,96 @@
+#include "balboa_energy.hpp"
+
+#include <cstring>
+
+using namespace balboa;
+
+namespace
+{
+    const uint32_t MS_PER_SECOND = 1000;
+    const uint32_t WATT_MS_PER_WH = 3600000;
+}
+
+EnergyMeter::EnergyMeter()
+{
+    memset(&_state, 0, sizeof(_state));
+    memset(_previous, 0, sizeof(_previous));
+    memset(_ms_remainder, 0, sizeof(_ms_remainder));
+    memset(_watt_ms_remainder, 0, sizeof(_watt_ms_remainder));
+    memset(_watts, 0, sizeof(_watts));
+    memset(_levels, 0, sizeof(_levels));
+}
+
+void EnergyMeter::SetWatts(Device device, uint8_t level, uint16_t watts)
+{
+    if (device < DEVICES && level >= 1 && level <= MAX_LEVEL)
+    {
+        _watts[device][level - 1] = watts;
+    }
+}
+
+void EnergyMeter::Levels(const Status::data_type &status, uint8_t levels[DEVICES])
+{
+    levels[PUMP1] = status.pump1;
+    levels[PUMP2] = status.pump2;
+    levels[PUMP3] = status.pump3;
+    levels[HEATER] = status.heating;
+    levels[CIRCULATION] = status.circulation_pump;
+    levels[BLOWER] = status.blower;
+    levels[LIGHTS] = status.lights ? 1 : 0; // 0b11 when on
+}
+
+void EnergyMeter::Roll(const Calendar &calendar)
+{
+    for (uint8_t p = 0; p < PERIODS; p++)
+    {
+        Totals &current = _state.current[p];
+        if (current.key != calendar.period[p])
+        {
+            _previous[p] = current;
+            memset(&current, 0, sizeof(current));
+            current.key = calendar.period[p];
+            _dirty = true;
+        }
+    }
+}
+
+void EnergyMeter::Update(uint32_t now_ms, const Calendar &calendar, const Status::data_type &status)
+{
+    Roll(calendar);
+
+    uint32_t dt = now_ms - _last_ms;
+    if (_started && dt <= MAX_GAP_MS)
+    {
+        for (uint8_t d = 0; d < DEVICES; d++)
+        {
+            uint8_t level = _levels[d];
+            if (!level)
+            {
+                continue;
+            }
+
+            uint32_t ms = _ms_remainder[d] + dt;
+            uint32_t seconds = ms / MS_PER_SECOND;
+            _ms_remainder[d] = (uint16_t)(ms % MS_PER_SECOND);
+
+            uint32_t &watt_ms = _watt_ms_remainder[d];
+            watt_ms += (uint32_t)_watts[d][level - 1] * dt;
+            uint32_t watt_hours = watt_ms / WATT_MS_PER_WH;
+            watt_ms %= WATT_MS_PER_WH;
+
+            if (seconds || watt_hours)
+            {
+                for (uint8_t p = 0; p < PERIODS; p++)
+                {
+                    _state.current[p].seconds[d] += seconds;
+                    _state.current[p].watt_hours[d] += watt_hours;
+                }
+                _dirty = true;
+            }
+        }
+    }
+
+    Levels(status, _levels);
+    _last_ms = now_ms;
+    _started = true;
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "balboa_messages.hpp"
+
+/**
+ * Runtime and energy accounting from Status frames.
+ *
+ * Integer only.  Each Status charges the time since the previous one to the
+ * devices that were running in the previous one, so only that last state is
+ * kept.  Whole seconds and watt-hours are carried into hour, day and month
+ * buckets; the remainders stay in the meter so nothing is lost to rounding
+ * while it runs.
+ */
+namespace balboa
+{
+    class EnergyMeter
+    {
+    public:
+        enum Device
+        {
+            PUMP1,
+            PUMP2,
+            PUMP3,
+            HEATER,
+            CIRCULATION,
+            BLOWER,
+            LIGHTS,
+            DEVICES
+        };
+
+        enum Period
+        {
+            HOUR,
+            DAY,
+            MONTH,
+            PERIODS
+        };
+
+        /**
+         * Device levels are 1..MAX_LEVEL, 0 is off: pumps 1 low, 2 high;
+         * heater 1 heating, 2 heat waiting; blower 1..3; circulation and
+         * lights only use 1.
+         */
+        static const uint8_t MAX_LEVEL = 3;
+
+        /** Longest gap charged to one frame, longer gaps mean the bus was lost. */
+        static const uint32_t MAX_GAP_MS = 10000;
+
+        /**
+         * Caller supplied period numbers, e.g. hours/days/months since an
+         * epoch.  A bucket starts over whenever its number changes.
+         */
+        struct Calendar
+        {
+            uint32_t period[PERIODS];
+        };
+
+        struct Totals
+        {
+            uint32_t key;
+            uint32_t seconds[DEVICES];
+            uint32_t watt_hours[DEVICES];
+        };
+
+        /**
+         * What is persisted, plain data.  Kept to the running buckets
+         * (180 bytes) so it fits the small ESP8266 flash store; previous
+         * buckets and sub-unit remainders start over after a reboot.
+         */
+        struct State
+        {
+            Totals current[PERIODS];
+        };
+
+        EnergyMeter();
+
+        void SetWatts(Device device, uint8_t level, uint16_t watts);
+
+        void Update(uint32_t now_ms, const Calendar &calendar, const Status::data_type &status);
+
+        const Totals &current(Period period) const { return _state.current[period]; }
+        const Totals &previous(Period period) const { return _previous[period]; }
+
+        State &state() { return _state; }
+        bool dirty() const { return _dirty; }
+        void clean() { _dirty = false; }
+
+        static void Levels(const Status::data_type &status, uint8_t levels[DEVICES]);
+
+    private:
+        void Roll(const Calendar &calendar);
+
+        State _state;
+        Totals _previous[PERIODS];
+        uint16_t _ms_remainder[DEVICES];
+        uint32_t _watt_ms_remainder[DEVICES];
+        uint16_t _watts[DEVICES][MAX_LEVEL];
+        uint8_t _levels[DEVICES];
+        uint32_t _last_ms = 0;
+        bool _started = false;
+        bool _dirty = false;
+    };
+};
@@ -0,0 +1,163 @@
+#include "balboa_fault_log.hpp"
+
+#include <cstring>
+
+using namespace balboa;
+
+namespace
+{
+    const uint16_t MINUTES_PER_DAY = 24 * 60;
+
+    bool Before(const FaultLogIndex::Entry &a, const FaultLogIndex::Entry &b)
+    {
+        return a.message_code < b.message_code ||
+               (a.message_code == b.message_code && a.minute < b.minute);
+    }
+}
+
+FaultLogIndex::FaultLogIndex()
+{
+    memset(&_stored, 0, sizeof(_stored));
+    memset(_by_code, 0, sizeof(_by_code));
+}
+
+void FaultLogIndex::Loaded()
+{
+    if (_stored.count > CAPACITY)
+    {
+        _stored.count = 0;
+    }
+    Reindex();
+}
+
+void FaultLogIndex::Reindex()
+{
+    // Insertion sort, the index is small and nearly sorted after one Add.
+    for (uint8_t i = 0; i < _stored.count; i++)
+    {
+        uint8_t j = i;
+        while (j && Before(_stored.entries[i], _stored.entries[_by_code[j - 1]]))
+        {
+            _by_code[j] = _by_code[j - 1];
+            j--;
+        }
+        _by_code[j] = i;
+    }
+}
+
+bool FaultLogIndex::Add(const FaultLogResponse::data_type &data, uint32_t day, uint16_t minute_of_day)
+{
+    Entry entry;
+    uint32_t days_back = data.days_ago;
+    // An entry later in the day than now happened before midnight.
+    uint16_t at = (data.hours % 24) * 60 + data.minutes % 60;
+    if (at > minute_of_day && !days_back)
+    {
+        days_back = 1;
+    }
+    entry.minute = (day > days_back ? day - days_back : 0) * MINUTES_PER_DAY + at;
+    entry.message_code = data.message_code;
+    entry.set_temperature = data.set_temperature;
+    entry.sensor_a_temp = data.sensor_a_temp;
+    entry.sensor_b_temp = data.sensor_b_temp;
+
+    Entry *entries = _stored.entries;
+    uint8_t &count = _stored.count;
+
+    // Upper bound by minute keeps equal times in arrival order.
+    uint8_t lo = 0, hi = count;
+    while (lo < hi)
+    {
+        uint8_t mid = (lo + hi) / 2;
+        if (entries[mid].minute <= entry.minute)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    // A re-read entry may land a minute off after a clock change.
+    for (uint8_t i = lo > 2 ? lo - 2 : 0; i < count && i < lo + 2; i++)
+    {
+        uint32_t delta = entries[i].minute > entry.minute ? entries[i].minute - entry.minute
+                                                          : entry.minute - entries[i].minute;
+        if (delta <= 1 && entries[i].message_code == entry.message_code &&
+            entries[i].sensor_a_temp == entry.sensor_a_temp && entries[i].sensor_b_temp == entry.sensor_b_temp)
+        {
+            return false;
+        }
+    }
+
+    if (count == CAPACITY)
+    {
+        if (!lo)
+        {
+            return false; // older than everything kept
+        }
+        memmove(entries, entries + 1, (CAPACITY - 1) * sizeof(Entry));
+        count--;
+        lo--;
+    }
+
+    memmove(entries + lo + 1, entries + lo, (count - lo) * sizeof(Entry));
+    entries[lo] = entry;
+    count++;
+
+    Reindex();
+    _dirty = true;
+    return true;
+}
+
+size_t FaultLogIndex::Query(uint32_t from, uint32_t to, Entry *out, size_t max) const
+{
+    size_t found = 0;
+    for (uint8_t i = 0; i < _stored.count && found < max; i++)
+    {
+        const Entry &entry = _stored.entries[i];
+        if (entry.minute >= to)
+        {
+            break;
+        }
+        if (entry.minute >= from)
+        {
+            out[found++] = entry;
+        }
+    }
+    return found;
+}
+
+size_t FaultLogIndex::Query(uint8_t message_code, uint32_t from, uint32_t to, Entry *out, size_t max) const
+{
+    Entry key;
+    key.message_code = message_code;
+    key.minute = from;
+
+    uint8_t lo = 0, hi = _stored.count;
+    while (lo < hi)
+    {
+        uint8_t mid = (lo + hi) / 2;
+        if (Before(_stored.entries[_by_code[mid]], key))
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    size_t found = 0;
+    for (uint8_t i = lo; i < _stored.count && found < max; i++)
+    {
+        const Entry &entry = _stored.entries[_by_code[i]];
+        if (entry.message_code != message_code || entry.minute >= to)
+        {
+            break;
+        }
+        out[found++] = entry;
+    }
+    return found;
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "balboa_messages.hpp"
+
+/**
+ * Index of the spa fault log.
+ *
+ * FaultLogResponse entries are relative ("days_ago" plus a time of day);
+ * they are pinned to absolute minutes using today as days since 1970-01-01
+ * and the Status clock, kept sorted by time, and indexed a second time by
+ * message_code so "code X since T" is a binary search.  The stored form is a
+ * plain struct so it can go to flash as is, or be merged with other spas'
+ * on a host.
+ */
+namespace balboa
+{
+    class FaultLogIndex
+    {
+    public:
+        /** As many as the controller keeps, 193 bytes stored. */
+        static const uint8_t CAPACITY = 24;
+
+        enum MessageCode
+        {
+            SENSORS_OUT_OF_SYNC         = 15,
+            LOW_FLOW                    = 16,
+            FLOW_FAILED                 = 17,
+            SENSORS_OUT_OF_SYNC_SERVICE = 26,
+            HEATER_DRY                  = 27,
+            WATER_TOO_HOT               = 29,
+            HEATER_TOO_HOT              = 30,
+            SENSOR_A_FAULT              = 31,
+            SENSOR_B_FAULT              = 32
+        };
+
+        struct Entry
+        {
+            uint32_t minute; // local minutes since 1970-01-01
+            uint8_t message_code;
+            uint8_t set_temperature;
+            uint8_t sensor_a_temp;
+            uint8_t sensor_b_temp;
+        } __attribute__((packed));
+
+        struct Stored
+        {
+            uint8_t count;
+            Entry entries[CAPACITY]; // ascending by minute
+        } __attribute__((packed));
+
+        FaultLogIndex();
+
+        /**
+         * Pins `data` to absolute time.  `day` is today as days since
+         * 1970-01-01 and `minute_of_day` the spa clock.  Returns false for a duplicate.
+         * When full the oldest entry goes.
+         */
+        bool Add(const FaultLogResponse::data_type &data, uint32_t day, uint16_t minute_of_day);
+
+        /** Entries with `from` <= minute < `to`, oldest first. */
+        size_t Query(uint32_t from, uint32_t to, Entry *out, size_t max) const;
+
+        /** Same, for one message_code only; uses the code index. */
+        size_t Query(uint8_t message_code, uint32_t from, uint32_t to, Entry *out, size_t max) const;
+
+        uint8_t size() const { return _stored.count; }
+        const Entry &operator[](uint8_t i) const { return _stored.entries[i]; }
+
+        Stored &stored() { return _stored; }
+        /** Call after stored() was filled from flash. */
+        void Loaded();
+
+        bool dirty() const { return _dirty; }
+        void clean() { _dirty = false; }
+
+    private:
+        void Reindex();
+
+        Stored _stored;
+        uint8_t _by_code[CAPACITY]; // positions, ascending by (code, minute)
+        bool _dirty = false;
+    };
+};
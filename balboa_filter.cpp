@@ -0,0 +1,111 @@
+#include "balboa_filter.hpp"
+
+#include <cstring>
+
+using namespace balboa;
+
+bool FilterSchedule::Set(const FilterCyclesResponse::data_type &data)
+{
+    Window windows[2] = {};
+    uint8_t count = 1;
+    windows[0].start = (data.filter1_start_hour % 24) * 60 + data.filter1_start_minute % 60;
+    windows[0].duration = data.filter1_duration_hours * 60 + data.filter1_duration_minutes;
+
+    if (data.filter2_enabled)
+    {
+        windows[1].start = (data.filter2_start_hour % 24) * 60 + data.filter2_start_minute % 60;
+        windows[1].duration = data.filter2_duration_hours * 60 + data.filter2_duration_minutes;
+        count = 2;
+    }
+
+    bool changed = !_known || count != _count || memcmp(windows, _windows, sizeof(windows)) != 0;
+    memcpy(_windows, windows, sizeof(windows));
+    _count = count;
+    _mismatches = 0;
+    _known = true;
+    _valid = true;
+    return changed;
+}
+
+bool FilterSchedule::Inside(const Window &window, uint16_t minute)
+{
+    if (window.duration >= MINUTES_PER_DAY)
+    {
+        return true;
+    }
+    // Unsigned distance from the start wraps midnight for free.
+    uint16_t since = (minute + MINUTES_PER_DAY - window.start) % MINUTES_PER_DAY;
+    return since < window.duration;
+}
+
+uint8_t FilterSchedule::Active(uint16_t minute) const
+{
+    uint8_t active = 0;
+    for (uint8_t i = 0; i < _count; i++)
+    {
+        if (Inside(_windows[i], minute % MINUTES_PER_DAY))
+        {
+            active |= 1 << i;
+        }
+    }
+    return active;
+}
+
+bool FilterSchedule::Next(uint16_t minute, uint16_t &minutes_until, Filter &filter) const
+{
+    bool found = false;
+    minute %= MINUTES_PER_DAY;
+
+    for (uint8_t i = 0; i < _count; i++)
+    {
+        if (!_windows[i].duration)
+        {
+            continue;
+        }
+        uint16_t until = (_windows[i].start + MINUTES_PER_DAY - minute) % MINUTES_PER_DAY;
+        if (!found || until < minutes_until)
+        {
+            minutes_until = until;
+            filter = i ? FILTER2 : FILTER1;
+            found = true;
+        }
+    }
+    return found;
+}
+
+uint8_t FilterSchedule::ActiveWithSlack(uint16_t minute, uint8_t running) const
+{
+    // A filter bit may flip up to a minute either side of the window edge.
+    uint8_t now = Active(minute);
+    uint8_t edge = (now ^ Active(minute + 1)) | (now ^ Active(minute + MINUTES_PER_DAY - 1));
+    return (now & ~edge) | (running & edge);
+}
+
+bool FilterSchedule::Check(const Status::data_type &status)
+{
+    if (!_valid)
+    {
+        return false;
+    }
+
+    uint8_t running = status.filter1_running | status.filter2_running << 1;
+    if (running == ActiveWithSlack(MinuteOfDay(status), running))
+    {
+        _mismatches = 0;
+        return true;
+    }
+
+    if (++_mismatches >= MISMATCH_LIMIT)
+    {
+        _valid = false;
+        return false;
+    }
+    return true;
+}
+
+int16_t FilterSchedule::Drift(const Status::data_type &status, uint8_t hour, uint8_t minute)
+{
+    int16_t drift = (int16_t)MinuteOfDay(status) - (hour * 60 + minute);
+    drift = (drift + MINUTES_PER_DAY) % MINUTES_PER_DAY;
+    return drift >= MINUTES_PER_DAY / 2 ? drift - MINUTES_PER_DAY : drift;
+}
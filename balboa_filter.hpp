@@ -0,0 +1,73 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "balboa_messages.hpp"
+
+/**
+ * Filter cycle schedule built from a FilterCyclesResponse.
+ *
+ * Answers "filtering now / next run at" from the spa clock in Status, so the
+ * cycles only need fetching again when the spa disagrees with the schedule,
+ * e.g. after they were changed at the panel.
+ */
+namespace balboa
+{
+    class FilterSchedule
+    {
+    public:
+        static const uint16_t MINUTES_PER_DAY = 24 * 60;
+
+        /** Consecutive disagreeing Status frames before the schedule is stale. */
+        static const uint8_t MISMATCH_LIMIT = 8;
+
+        enum Filter
+        {
+            FILTER1 = 0x01,
+            FILTER2 = 0x02
+        };
+
+        /** Returns false when the windows are the ones already set. */
+        bool Set(const FilterCyclesResponse::data_type &data);
+        bool valid() const { return _valid; }
+
+        /** Bitmask of Filter expected to run at `minute` of the day. */
+        uint8_t Active(uint16_t minute) const;
+
+        /**
+         * Minutes from `minute` to the next window start, 0 if one starts
+         * right now; `filter` tells which.  False without any window.
+         */
+        bool Next(uint16_t minute, uint16_t &minutes_until, Filter &filter) const;
+
+        /**
+         * Compares the running bits of a Status with the schedule.  Edges
+         * are given a minute of slack.  Returns false once the spa disagreed
+         * MISMATCH_LIMIT times in a row, the schedule should be refetched.
+         */
+        bool Check(const Status::data_type &status);
+
+        /**
+         * Signed minutes the spa clock is ahead of `hour`:`minute`, folded
+         * into -720..719.
+         */
+        static int16_t Drift(const Status::data_type &status, uint8_t hour, uint8_t minute);
+
+        static uint16_t MinuteOfDay(const Status::data_type &status) { return status.hour * 60 + status.minute; }
+
+    private:
+        struct Window
+        {
+            uint16_t start;
+            uint16_t duration;
+        };
+
+        static bool Inside(const Window &window, uint16_t minute);
+        uint8_t ActiveWithSlack(uint16_t minute, uint8_t running) const;
+
+        Window _windows[2] = {};
+        uint8_t _count = 0;
+        uint8_t _mismatches = 0;
+        bool _known = false; // Set() was called, even if no longer _valid
+        bool _valid = false;
+    };
+};
@@ -1,5 +1,16 @@
 #include "balboa_messages.hpp"
 
+#include <cstdio>
+#include <cstring>
+
+// Under ESPHome dumps go through its logger.
+#if defined(__has_include)
+#if __has_include("esphome/core/log.h")
+#include "esphome/core/log.h"
+#define BALBOA_ESPHOME_LOG
+#endif
+#endif
+
 using namespace balboa;
 
 void SettingsRequest::SetSettingsType(request_type type, data_type &data)
@@ -75,6 +86,102 @@ void SetTempScaleRequest::SetScale(bool isCelsius, data_type &data)
     data.scale = isCelsius;
 }
 
+namespace
+{
+    /**
+     * CRC-8 lookup table, generated at compile time and shared by every
+     * parser instance.
+     */
+    struct CRCTable
+    {
+        uint8_t value[256];
+
+        constexpr CRCTable() : value()
+        {
+            for (int i = 0; i < 256; i++)
+            {
+                uint8_t crc = (uint8_t)i;
+                for (int bit = 0; bit < 8; bit++)
+                {
+                    crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+                }
+                value[i] = crc;
+            }
+        }
+    };
+
+    constexpr CRCTable CRC_TABLE;
+}
+
+uint8_t balboa::CalcCRC(const uint8_t *data, size_t length)
+{
+    uint8_t crc = 0x02;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        crc = CRC_TABLE.value[crc ^ data[i]];
+    }
+
+    return crc ^ 0x02;
+}
+
+const uint8_t *balboa::FindFrame(const uint8_t *begin, const uint8_t *end, const uint8_t *limit)
+{
+    for (const uint8_t *p = begin; p < end; p++)
+    {
+        p = (const uint8_t *)memchr(p, 0x7e, end - p);
+        if (!p)
+        {
+            break;
+        }
+        // Prefix, length >= 5 (length byte, three type bytes, crc), suffix, crc.
+        size_t room = limit - p;
+        if (room >= 7 && p[1] >= 5 && room >= p[1] + 2u && p[p[1] + 1] == 0x7e && CalcCRC(p + 1, p[1] - 1) == p[p[1]])
+        {
+            return p;
+        }
+    }
+    return nullptr;
+}
+
+void balboa::DumpFrame(const uint8_t *frame, uint8_t payload_length, uint8_t crc)
+{
+#ifdef BALBOA_ESPHOME_LOG
+    // Not printf: on the device that is UART0, which may be the spa bus.
+    const unsigned size = payload_length + 7u;
+    const unsigned DUMP_PER_LINE = 16;
+    ESP_LOGD("balboa", "Dump - # bytes: %u", size);
+
+    char line[DUMP_PER_LINE * 3 + 1];
+    for (unsigned start = 0; start < size; start += DUMP_PER_LINE)
+    {
+        char *out = line;
+        for (unsigned i = start; i < size && i < start + DUMP_PER_LINE; i++)
+        {
+            uint8_t byte = i == 0 || i == size - 1 ? 0x7e : i == size - 2 ? crc : frame[i - 1];
+            out += snprintf(out, line + sizeof(line) - out, i == start ? "%02x" : " %02x", byte);
+        }
+        ESP_LOGD("balboa", "%s", line);
+    }
+#else
+    printf("Dump - # bytes: %u\n7e", payload_length + 7u);
+    for (uint8_t i = 0; i < payload_length + 4; i++)
+    {
+        printf(" %02x", frame[i]);
+    }
+    printf(" %02x 7e\n", crc);
+#endif
+}
+
+uint8_t balboa::WriteFrame(const uint8_t *frame, uint8_t payload_length, uint8_t crc, uint8_t *out)
+{
+    out[0] = 0x7e;
+    memcpy(out + 1, frame, payload_length + 4);
+    out[payload_length + 5] = crc;
+    out[payload_length + 6] = 0x7e;
+    return payload_length + 7;
+}
+
 #if 0
 balboa::MessageBase::MessageBase(size_t size, unsigned long messageType)
 {
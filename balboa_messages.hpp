@@ -37,7 +37,7 @@ namespace balboa
 
         struct length_type
         {
-            static constexpr uint8_t length = sizeof(data_type);
+            static constexpr uint8_t length = 0; // empty payload
         };
     };
 
@@ -177,7 +177,7 @@ namespace balboa
 
         struct length_type
         {
-            static constexpr uint8_t length = sizeof(data_type);
+            static constexpr uint8_t length = 0; // empty payload
         };
     };
 
@@ -235,7 +235,7 @@ namespace balboa
 
         struct length_type
         {
-            static constexpr uint8_t length = sizeof(data_type);
+            static constexpr uint8_t length = 0; // empty payload
         };
     };
 
@@ -283,8 +283,8 @@ namespace balboa
             uint8_t unknown8 : 1;          // 18 both 18 & 19, bit 2 seem related to time not
             uint8_t time_unset : 1;        // 18 yet set.
             uint8_t : 0;                   // 18 pad
-            uint8_t unknown8 : 1;          // 19 both 18 & 19, bit 2 seem related to time not
-            uint8_t time_unset : 1;        // 19 yet set.
+            uint8_t unknown8b : 1;         // 19 both 18 & 19, bit 2 seem related to time not
+            uint8_t time_unset_b : 1;      // 19 yet set.
             uint8_t : 0;                   // 19 pad
             uint8_t set_temp;              // 20
             uint8_t unknown9 : 2;          // 21
@@ -338,7 +338,7 @@ namespace balboa
             uint32_t signature;           // 13->16
             uint16_t heater_type;         // 17, 18 : 0x0a - standard
             uint16_t dip_switch_settings; // 19, 20
-        };
+        } __attribute__((packed));
 
         struct length_type
         {
@@ -424,23 +424,60 @@ namespace balboa
 
 
 
+    /**
+     * CRC-8 (poly 0x07, init 0x02, xor-out 0x02) over `length` bytes starting
+     * at the length byte of a frame, i.e. everything between prefix and crc.
+     */
+    uint8_t CalcCRC(const uint8_t *data, size_t length);
+
+    /**
+     * First whole frame with a valid crc that starts in [`begin`, `end`):
+     * returns its 0x7e prefix, the frame is p[1] + 2 bytes, or null.  The
+     * frame may run past `end` up to `limit`, so a file scanned in chunks
+     * counts each frame once.  For captures held in memory; live bus bytes
+     * go through FrameParser.
+     */
+    const uint8_t *FindFrame(const uint8_t *begin, const uint8_t *end, const uint8_t *limit);
+    inline const uint8_t *FindFrame(const uint8_t *begin, const uint8_t *end) { return FindFrame(begin, end, end); }
+
+    /**
+     * Non template frame helpers behind Message<MS>.  `frame` points at the
+     * length byte and is followed by the type and `payload_length` payload
+     * bytes; the crc is passed separately since an empty data_type still
+     * takes one byte in the struct.
+     */
+    void DumpFrame(const uint8_t *frame, uint8_t payload_length, uint8_t crc);
+    uint8_t WriteFrame(const uint8_t *frame, uint8_t payload_length, uint8_t crc, uint8_t *out);
+
+    /**
+     * Typed view of a frame.  Every member forwards to the helpers above so
+     * an extra message class costs next to nothing in flash.
+     */
     template <class MS>
     struct Message
     {
         static const uint8_t prefix = 0x7e;
-        typename MS::length_type length;
-        typename MS::header_type type;
+        uint8_t length;
+        uint8_t type[3];
         typename MS::data_type data;
         uint8_t crc;
         static const uint8_t suffix = 0x7e;
 
-        Message(){};
+        Message()
+            : length(MS::length_type::length + 5),
+              type{MS::header_type::byte1, MS::header_type::byte2, MS::header_type::byte3},
+              data(), crc(0)
+        {
+        }
 
-        void Dump() const;
-        void SetCRC();
-        bool CheckCRC() const;
-        uint8_t CalcCRC() const;
-    };
+        void Dump() const { DumpFrame(&length, MS::length_type::length, crc); }
+        void SetCRC() { crc = CalcCRC(); }
+        bool CheckCRC() const { return crc == CalcCRC(); }
+        uint8_t CalcCRC() const { return balboa::CalcCRC(&length, 4 + MS::length_type::length); }
+
+        /** Writes prefix to suffix to `out`, returns the frame size. */
+        uint8_t Write(uint8_t *out) const { return WriteFrame(&length, MS::length_type::length, crc, out); }
+    } __attribute__((packed));
 
 #if 0
     constexpr uint32_t MESSAGE_ID(uint8_t b1, uint8_t b2, uint8_t b3)
@@ -0,0 +1,177 @@
+#include "balboa_parser.hpp"
+
+#include <cstring>
+
+using namespace balboa;
+
+namespace
+{
+    const uint8_t FRAME_MARK = 0x7e;
+    const uint8_t FRAME_OVERHEAD = 5; // length, type[3], crc
+
+    struct Route
+    {
+        uint8_t type[3];
+        uint8_t length;
+        void (*call)(MessageHandler &, const uint8_t *);
+    };
+
+    template <class MS, void (MessageHandler::*ON)(const typename MS::data_type &)>
+    void Call(MessageHandler &handler, const uint8_t *payload)
+    {
+        typename MS::data_type data;
+        memcpy(&data, payload, MS::length_type::length);
+        (handler.*ON)(data);
+    }
+
+    template <class MS, void (MessageHandler::*ON)(const typename MS::data_type &)>
+    constexpr Route MakeRoute()
+    {
+        return Route{{MS::header_type::byte1, MS::header_type::byte2, MS::header_type::byte3},
+                     MS::length_type::length,
+                     &Call<MS, ON>};
+    }
+
+    constexpr Route ROUTES[] = {
+        MakeRoute<Status, &MessageHandler::OnStatus>(),
+        MakeRoute<ReadyToSend, &MessageHandler::OnReadyToSend>(),
+        MakeRoute<FilterCyclesResponse, &MessageHandler::OnFilterCycles>(),
+        MakeRoute<InformationResponse, &MessageHandler::OnInformation>(),
+        MakeRoute<FaultLogResponse, &MessageHandler::OnFaultLog>(),
+        MakeRoute<ControlConfig2Response, &MessageHandler::OnControlConfig2>(),
+        MakeRoute<ConfigResponse, &MessageHandler::OnConfig>(),
+        MakeRoute<SetTempRange, &MessageHandler::OnSetTempRange>(),
+    };
+}
+
+bool balboa::Dispatch(const uint8_t *frame, MessageHandler &handler)
+{
+    for (const Route &route : ROUTES)
+    {
+        if (frame[0] == route.length + FRAME_OVERHEAD && !memcmp(frame + 1, route.type, 3))
+        {
+            route.call(handler, frame + 4);
+            return true;
+        }
+    }
+
+    handler.OnUnhandled(frame);
+    return false;
+}
+
+/*****************************************************************
+**************************PARSER**********************************
+******************************************************************/
+
+size_t FrameParser::Feed(const uint8_t *data, size_t length, MessageHandler &handler)
+{
+    size_t found = 0;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        if (!_used && data[i] != FRAME_MARK)
+        {
+            _dropped++;
+            continue;
+        }
+        _buffer[_used++] = data[i];
+
+        // _buffer[0] is always a prefix candidate here.
+        while (_used >= 2)
+        {
+            uint8_t size = _buffer[1];
+            if (size < FRAME_OVERHEAD || size + 2 > BUFFER_SIZE)
+            {
+                Resync();
+                continue;
+            }
+            if (_used < size + 2)
+            {
+                break;
+            }
+            if (_buffer[size + 1] != FRAME_MARK || CalcCRC(_buffer + 1, size - 1) != _buffer[size])
+            {
+                Resync();
+                continue;
+            }
+
+            Dispatch(_buffer + 1, handler);
+            _frames++;
+            found++;
+
+            // After a resync the next frame may already be buffered behind this one.
+            if (_used == size + 2)
+            {
+                _used = 0;
+            }
+            else
+            {
+                _dropped += Shift(size + 2) - (size + 2);
+            }
+        }
+    }
+
+    return found;
+}
+
+void FrameParser::Resync()
+{
+    // Drop the bad prefix and restart at the next frame mark, if any.
+    _dropped += Shift(1);
+}
+
+uint8_t FrameParser::Shift(uint8_t count)
+{
+    const uint8_t *next = (const uint8_t *)memchr(_buffer + count, FRAME_MARK, _used - count);
+    uint8_t skip = next ? (uint8_t)(next - _buffer) : _used;
+
+    memmove(_buffer, _buffer + skip, _used - skip);
+    _used -= skip;
+    return skip;
+}
+
+/*****************************************************************
+**************************TX QUEUE********************************
+******************************************************************/
+
+bool TxQueue::Push(uint8_t byte1, uint8_t byte2, uint8_t byte3, const void *data, uint8_t length)
+{
+    if (_count == DEPTH || length + FRAME_OVERHEAD + 2 > FRAME_SIZE)
+    {
+        return false;
+    }
+
+    uint8_t *frame = _frames[(_head + _count) % DEPTH];
+    frame[0] = FRAME_MARK;
+    frame[1] = length + FRAME_OVERHEAD;
+    frame[2] = byte1;
+    frame[3] = byte2;
+    frame[4] = byte3;
+    memcpy(frame + 5, data, length);
+    frame[length + 5] = CalcCRC(frame + 1, length + FRAME_OVERHEAD - 1);
+    frame[length + 6] = FRAME_MARK;
+
+    _count++;
+    return true;
+}
+
+const uint8_t *TxQueue::Front(uint8_t &size) const
+{
+    if (!_count)
+    {
+        return nullptr;
+    }
+
+    const uint8_t *frame = _frames[_head];
+    size = frame[1] + 2;
+    return frame;
+}
+
+void TxQueue::Pop()
+{
+    if (_count)
+    {
+        _head = (_head + 1) % DEPTH;
+        _count--;
+    }
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "balboa_messages.hpp"
+
+/**
+ * Frame parsing shared by every spa on the device.
+ *
+ * The decode/dispatch table and the CRC table are static and exist once no
+ * matter how many buses are handled.  A FrameParser and a TxQueue are the only
+ * per-bus state, a few dozen bytes each.
+ */
+namespace balboa
+{
+    /**
+     * Receives decoded responses.  Overrides are optional, anything without a
+     * route ends in OnUnhandled() with the frame starting at its length byte.
+     */
+    class MessageHandler
+    {
+    public:
+        virtual void OnReadyToSend(const ReadyToSend::data_type &) {}
+        virtual void OnStatus(const Status::data_type &) {}
+        virtual void OnFilterCycles(const FilterCyclesResponse::data_type &) {}
+        virtual void OnInformation(const InformationResponse::data_type &) {}
+        virtual void OnFaultLog(const FaultLogResponse::data_type &) {}
+        virtual void OnControlConfig2(const ControlConfig2Response::data_type &) {}
+        virtual void OnConfig(const ConfigResponse::data_type &) {}
+        virtual void OnSetTempRange(const SetTempRange::data_type &) {}
+        virtual void OnUnhandled(const uint8_t *) {}
+
+    protected:
+        ~MessageHandler() = default;
+    };
+
+    /**
+     * Routes one CRC checked frame (starting at the length byte) through the
+     * static table.  Returns false if no route matched.
+     */
+    bool Dispatch(const uint8_t *frame, MessageHandler &handler);
+
+    class FrameParser
+    {
+    public:
+        /** Largest frame kept, prefix and suffix included. */
+        static const uint8_t BUFFER_SIZE = 40;
+
+        /**
+         * Consumes `length` bytes from the bus and dispatches every complete
+         * frame.  Returns the number of frames found.
+         */
+        size_t Feed(const uint8_t *data, size_t length, MessageHandler &handler);
+
+        uint32_t frames() const { return _frames; }
+        uint32_t dropped() const { return _dropped; }
+
+    private:
+        void Resync();
+        /** Drops `count` bytes and whatever precedes the next frame mark. */
+        uint8_t Shift(uint8_t count);
+
+        uint8_t _buffer[BUFFER_SIZE];
+        uint8_t _used = 0;
+        uint32_t _frames = 0;
+        uint32_t _dropped = 0;
+    };
+
+    class TxQueue
+    {
+    public:
+        static const uint8_t DEPTH = 4;
+        static const uint8_t FRAME_SIZE = 16;
+
+        template <class MS>
+        bool Push(const typename MS::data_type &data)
+        {
+            return Push(MS::header_type::byte1, MS::header_type::byte2, MS::header_type::byte3,
+                        &data, MS::length_type::length);
+        }
+
+        bool Push(uint8_t byte1, uint8_t byte2, uint8_t byte3, const void *data, uint8_t length);
+
+        /**
+         * The oldest frame, prefix to suffix, and its size; nullptr when
+         * empty.  It stays queued until Pop() so a refused write can retry.
+         */
+        const uint8_t *Front(uint8_t &size) const;
+        void Pop();
+
+        bool empty() const { return !_count; }
+
+    private:
+        uint8_t _frames[DEPTH][FRAME_SIZE];
+        uint8_t _head = 0;
+        uint8_t _count = 0;
+    };
+};
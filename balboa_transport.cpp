@@ -0,0 +1,198 @@
+#include "balboa_transport.hpp"
+
+#ifndef USE_ESP8266
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+using namespace balboa;
+
+namespace
+{
+    uint32_t NowMs()
+    {
+        using namespace std::chrono;
+        return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+    }
+
+    bool WouldBlock()
+    {
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+}
+
+bool TcpTransport::Connect(const char *address, uint16_t port)
+{
+    in_addr parsed;
+    if (inet_pton(AF_INET, address, &parsed) != 1)
+    {
+        return false;
+    }
+
+    Close();
+    _address = parsed.s_addr;
+    _port = port;
+    return Open();
+}
+
+bool TcpTransport::Open()
+{
+    _fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (_fd < 0)
+    {
+        Drop();
+        return false;
+    }
+
+    int one = 1;
+    setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL, 0) | O_NONBLOCK);
+
+    sockaddr_in peer = {};
+    peer.sin_family = AF_INET;
+    peer.sin_port = htons(_port);
+    peer.sin_addr.s_addr = _address;
+
+    _rx_pos = _rx_used = _tx_used = 0;
+    if (connect(_fd, (sockaddr *)&peer, sizeof(peer)) == 0)
+    {
+        _state = CONNECTED;
+        return true;
+    }
+    if (errno == EINPROGRESS)
+    {
+        _state = CONNECTING;
+        return true;
+    }
+
+    Drop();
+    return false;
+}
+
+void TcpTransport::Close()
+{
+    if (_fd >= 0)
+    {
+        close(_fd);
+    }
+    _fd = -1;
+    _state = IDLE;
+}
+
+void TcpTransport::Drop()
+{
+    if (_fd >= 0)
+    {
+        close(_fd);
+    }
+    _fd = -1;
+    _state = CLOSED;
+    _closed_ms = NowMs();
+}
+
+bool TcpTransport::Poll()
+{
+    if (_state == CLOSED && NowMs() - _closed_ms >= RECONNECT_MS)
+    {
+        Open();
+    }
+    if (_state != CONNECTING)
+    {
+        return _state == CONNECTED;
+    }
+
+    fd_set writable;
+    FD_ZERO(&writable);
+    FD_SET(_fd, &writable);
+    timeval immediately = {0, 0};
+    if (select(_fd + 1, nullptr, &writable, nullptr, &immediately) <= 0)
+    {
+        return false;
+    }
+
+    int error = 0;
+    socklen_t size = sizeof(error);
+    if (getsockopt(_fd, SOL_SOCKET, SO_ERROR, &error, &size) < 0 || error)
+    {
+        Drop();
+        return false;
+    }
+
+    _state = CONNECTED;
+    return true;
+}
+
+size_t TcpTransport::Read(uint8_t *data, size_t length)
+{
+    if (_rx_pos == _rx_used)
+    {
+        if (_state != CONNECTED)
+        {
+            return 0;
+        }
+
+        ssize_t got = recv(_fd, _rx, RX_BUFFER, 0);
+        if (got <= 0)
+        {
+            if (got == 0 || !WouldBlock())
+            {
+                Drop();
+            }
+            return 0;
+        }
+        _rx_pos = 0;
+        _rx_used = (size_t)got;
+    }
+
+    size_t count = _rx_used - _rx_pos < length ? _rx_used - _rx_pos : length;
+    memcpy(data, _rx + _rx_pos, count);
+    _rx_pos += count;
+    return count;
+}
+
+bool TcpTransport::Write(const uint8_t *data, size_t length)
+{
+    if (_state != CONNECTED || _tx_used + length > TX_BUFFER)
+    {
+        return false;
+    }
+
+    memcpy(_tx + _tx_used, data, length);
+    _tx_used += length;
+    return true;
+}
+
+void TcpTransport::Flush()
+{
+    if (!Poll() || !_tx_used)
+    {
+        return;
+    }
+
+    ssize_t sent = send(_fd, _tx, _tx_used, MSG_NOSIGNAL);
+    if (sent < 0)
+    {
+        if (!WouldBlock())
+        {
+            Drop();
+        }
+        return;
+    }
+
+    // Keep whatever the socket did not take for the next tick.
+    _tx_used -= (size_t)sent;
+    memmove(_tx, _tx + sent, _tx_used);
+}
+#endif
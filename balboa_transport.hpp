@@ -0,0 +1,90 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Byte transports below the frame parser.
+ *
+ * The spa bus is a UART (see BalboaSpa); the Balboa Wi-Fi module speaks the
+ * same frames over TCP.  Both are driven once per loop: Read() until it
+ * returns 0, Write() the outgoing frames, then one Flush().
+ */
+namespace balboa
+{
+    class Transport
+    {
+    public:
+        virtual ~Transport() = default;
+
+        /** Copies up to `length` received bytes, never blocks.  0 when none. */
+        virtual size_t Read(uint8_t *data, size_t length) = 0;
+
+        /** Queues bytes for the next Flush().  False if they do not fit. */
+        virtual bool Write(const uint8_t *data, size_t length) = 0;
+
+        /** Sends what was queued since the last call. */
+        virtual void Flush() {}
+
+        virtual bool connected() const { return true; }
+
+        /**
+         * A shared bus may only be written after a ReadyToSend for our
+         * channel; a point to point link can send at any time.
+         */
+        virtual bool needs_clear_to_send() const { return true; }
+    };
+
+#ifndef USE_ESP8266
+    /**
+     * Non-blocking TCP client, e.g. to a Balboa Wi-Fi module.  Nagle is
+     * disabled since frames are already coalesced into one send per Flush(),
+     * and reads pull RX_BUFFER bytes per call.  A dropped connection is
+     * retried every RECONNECT_MS from Flush().
+     */
+    class TcpTransport : public Transport
+    {
+    public:
+        static const uint16_t DEFAULT_PORT = 4257;
+        static const size_t RX_BUFFER = 512;
+        static const size_t TX_BUFFER = 256;
+        static const uint32_t RECONNECT_MS = 5000;
+
+        ~TcpTransport() override { Close(); }
+
+        /** `address` is a dotted IPv4 address.  Returns false if it is not. */
+        bool Connect(const char *address, uint16_t port = DEFAULT_PORT);
+        void Close();
+
+        size_t Read(uint8_t *data, size_t length) override;
+        bool Write(const uint8_t *data, size_t length) override;
+        void Flush() override;
+
+        bool connected() const override { return _state == CONNECTED; }
+        bool needs_clear_to_send() const override { return false; }
+
+    private:
+        enum State
+        {
+            IDLE,
+            CLOSED,
+            CONNECTING,
+            CONNECTED
+        };
+
+        bool Open();
+        bool Poll();
+        void Drop();
+
+        int _fd = -1;
+        State _state = IDLE;
+        uint32_t _address = 0;
+        uint16_t _port = 0;
+        uint32_t _closed_ms = 0;
+        size_t _rx_pos = 0;
+        size_t _rx_used = 0;
+        size_t _tx_used = 0;
+        uint8_t _rx[RX_BUFFER];
+        uint8_t _tx[TX_BUFFER];
+    };
+#endif
+};
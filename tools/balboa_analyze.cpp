@@ -0,0 +1,497 @@
+/**
+ * Host side protocol discovery tool.
+ *
+ * Walks raw bus captures (the bytes exactly as read from the RS485 line),
+ * picks out every frame of one message type and reports, for each payload
+ * byte and bit, the entropy, how often it changes between consecutive frames
+ * and which known field it correlates with best.  Unknown bytes/bits are
+ * ranked so the interesting ones are at the top.
+ *
+ * Captures are mmapped and cut in fixed size chunks; worker threads pull the
+ * next chunk from a shared counter so a slow chunk never stalls the others.
+ * Per chunk statistics are plain sums and merge by addition.
+ *
+ *   g++ -O2 -std=c++17 -pthread -I.. balboa_analyze.cpp ../balboa_messages.cpp -o balboa_analyze
+ *   ./balboa_analyze [--type status|config|control2|temprange|faultlog] [--jobs N] capture...
+ */
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "balboa_messages.hpp"
+
+using namespace balboa;
+
+namespace
+{
+    constexpr size_t CHUNK_SIZE = 4 << 20;
+
+    struct Field
+    {
+        const char *name;
+        uint8_t byte;
+        uint8_t shift;
+        uint8_t width;
+
+        uint8_t Get(const uint8_t *payload) const
+        {
+            return (payload[byte] >> shift) & ((1u << width) - 1);
+        }
+    };
+
+    struct Target
+    {
+        const char *name;
+        uint8_t type[3];
+        uint8_t length;
+        std::vector<Field> known;
+    };
+
+    template <class MS>
+    Target MakeTarget(const char *name, std::vector<Field> known)
+    {
+        return Target{name,
+                      {MS::header_type::byte1, MS::header_type::byte2, MS::header_type::byte3},
+                      MS::length_type::length,
+                      std::move(known)};
+    }
+
+    std::vector<Target> Targets()
+    {
+        return {
+            MakeTarget<Status>("status", {
+                {"hold_mode", 0, 0, 8},
+                {"priming", 1, 0, 8},
+                {"current_temp", 2, 0, 8},
+                {"hour", 3, 0, 8},
+                {"minute", 4, 0, 8},
+                {"heating_mode", 5, 0, 8},
+                {"panel_message", 6, 0, 8},
+                {"hold_time", 8, 0, 8},
+                {"celsius", 9, 0, 1},
+                {"time_format", 9, 1, 1},
+                {"filter1_running", 9, 2, 1},
+                {"filter2_running", 9, 3, 1},
+                {"temp_range", 10, 2, 1},
+                {"heating", 10, 4, 2},
+                {"pump1", 11, 0, 2},
+                {"pump2", 11, 2, 2},
+                {"pump3", 11, 4, 2},
+                {"circulation_pump", 13, 1, 1},
+                {"blower", 13, 2, 2},
+                {"lights", 14, 0, 2},
+                {"mister", 15, 0, 1},
+                {"time_unset", 18, 1, 1},
+                {"time_unset_b", 19, 1, 1},
+                {"set_temp", 20, 0, 8},
+                {"system_hold", 21, 2, 1},
+            }),
+            MakeTarget<ConfigResponse>("config", {}),
+            MakeTarget<ControlConfig2Response>("control2", {}),
+            MakeTarget<SetTempRange>("temprange", {}),
+            MakeTarget<FaultLogResponse>("faultlog", {
+                {"fault_count", 0, 0, 8},
+                {"entry_number", 1, 0, 8},
+                {"message_code", 2, 0, 8},
+                {"days_ago", 3, 0, 8},
+                {"hours", 4, 0, 8},
+                {"minutes", 5, 0, 8},
+                {"set_temperature", 7, 0, 8},
+                {"sensor_a_temp", 8, 0, 8},
+                {"sensor_b_temp", 9, 0, 8},
+            }),
+        };
+    }
+
+    /**
+     * Running sums for one payload.  Everything is additive so per chunk
+     * instances can be merged in any order.
+     */
+    struct Stats
+    {
+        size_t length;
+        size_t fields;
+        uint64_t frames = 0;
+        uint64_t transitions = 0;
+        std::vector<uint64_t> histogram;   // [byte][256]
+        std::vector<uint64_t> bit_set;     // [byte * 8 + bit]
+        std::vector<uint64_t> byte_change; // [byte]
+        std::vector<uint64_t> bit_change;  // [byte * 8 + bit]
+        std::vector<double> sum_x;         // [byte]
+        std::vector<double> sum_xx;        // [byte]
+        std::vector<double> sum_y;         // [field]
+        std::vector<double> sum_yy;        // [field]
+        std::vector<double> sum_xy;        // [byte][field]
+        std::vector<double> sum_bit_y;     // [byte * 8 + bit][field], y summed where the bit is set
+        std::vector<double> scratch_y;     // [field], this frame's known values
+
+        Stats(size_t length, size_t fields)
+            : length(length), fields(fields),
+              histogram(length * 256), bit_set(length * 8),
+              byte_change(length), bit_change(length * 8),
+              sum_x(length), sum_xx(length), sum_y(fields), sum_yy(fields),
+              sum_xy(length * fields), sum_bit_y(length * 8 * fields), scratch_y(fields)
+        {
+        }
+
+        void Add(const uint8_t *payload, const uint8_t *previous, const Target &target)
+        {
+            frames++;
+            if (previous)
+            {
+                transitions++;
+            }
+
+            std::vector<double> &y = scratch_y;
+            for (size_t f = 0; f < fields; f++)
+            {
+                y[f] = target.known[f].Get(payload);
+                sum_y[f] += y[f];
+                sum_yy[f] += y[f] * y[f];
+            }
+
+            for (size_t i = 0; i < length; i++)
+            {
+                uint8_t x = payload[i];
+                histogram[i * 256 + x]++;
+                sum_x[i] += x;
+                sum_xx[i] += (double)x * x;
+
+                for (size_t f = 0; f < fields; f++)
+                {
+                    sum_xy[i * fields + f] += (double)x * y[f];
+                }
+
+                uint8_t diff = previous ? (uint8_t)(x ^ previous[i]) : 0;
+                if (diff)
+                {
+                    byte_change[i]++;
+                }
+
+                for (uint8_t bit = 0; bit < 8; bit++)
+                {
+                    bit_set[i * 8 + bit] += (x >> bit) & 1;
+                    bit_change[i * 8 + bit] += (diff >> bit) & 1;
+                    if ((x >> bit) & 1)
+                    {
+                        for (size_t f = 0; f < fields; f++)
+                        {
+                            sum_bit_y[(i * 8 + bit) * fields + f] += y[f];
+                        }
+                    }
+                }
+            }
+        }
+
+        void Merge(const Stats &other)
+        {
+            frames += other.frames;
+            transitions += other.transitions;
+            Sum(histogram, other.histogram);
+            Sum(bit_set, other.bit_set);
+            Sum(byte_change, other.byte_change);
+            Sum(bit_change, other.bit_change);
+            Sum(sum_x, other.sum_x);
+            Sum(sum_xx, other.sum_xx);
+            Sum(sum_y, other.sum_y);
+            Sum(sum_yy, other.sum_yy);
+            Sum(sum_xy, other.sum_xy);
+            Sum(sum_bit_y, other.sum_bit_y);
+        }
+
+        double Correlation(size_t byte, size_t field) const
+        {
+            return Pearson(sum_x[byte], sum_xx[byte], sum_xy[byte * fields + field], field);
+        }
+
+        /** Same for one bit; a 0/1 variable is its own square. */
+        double BitCorrelation(size_t byte, uint8_t bit, size_t field) const
+        {
+            double set = (double)bit_set[byte * 8 + bit];
+            return Pearson(set, set, sum_bit_y[(byte * 8 + bit) * fields + field], field);
+        }
+
+    private:
+        double Pearson(double sx, double sxx, double sxy, size_t field) const
+        {
+            double n = (double)frames;
+            double cov = n * sxy - sx * sum_y[field];
+            double vx = n * sxx - sx * sx;
+            double vy = n * sum_yy[field] - sum_y[field] * sum_y[field];
+            if (vx <= 0 || vy <= 0)
+            {
+                return 0;
+            }
+            return cov / std::sqrt(vx * vy);
+        }
+
+        template <class T>
+        static void Sum(std::vector<T> &into, const std::vector<T> &from)
+        {
+            for (size_t i = 0; i < into.size(); i++)
+            {
+                into[i] += from[i];
+            }
+        }
+    };
+
+    struct Chunk
+    {
+        const uint8_t *begin; // first byte a frame may start at
+        const uint8_t *end;   // frames must start before this
+        const uint8_t *limit; // end of the mapped file
+    };
+
+    /**
+     * Scans one chunk.  Only frames *starting* inside the chunk are counted,
+     * a frame may run past the chunk end into the rest of the file.
+     */
+    void ScanChunk(const Chunk &chunk, const Target &target, Stats &stats)
+    {
+        const size_t frame_length = target.length + 5;
+        const uint8_t *previous = nullptr;
+        const uint8_t *p = chunk.begin;
+
+        while ((p = FindFrame(p, chunk.end, chunk.limit)))
+        {
+            if (p[1] == frame_length && memcmp(p + 2, target.type, 3) == 0)
+            {
+                const uint8_t *payload = p + 5;
+                stats.Add(payload, previous, target);
+                previous = payload;
+            }
+
+            p += p[1] + 2;
+        }
+    }
+
+    double Entropy(const uint64_t *counts, size_t n, uint64_t total)
+    {
+        double h = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            if (counts[i])
+            {
+                double p = (double)counts[i] / total;
+                h -= p * std::log2(p);
+            }
+        }
+        return h;
+    }
+
+    struct Row
+    {
+        std::string what;
+        double entropy;
+        double change;
+        const char *best;
+        double r;
+    };
+
+    void Report(const Target &target, const Stats &stats)
+    {
+        printf("type %s (%02X %02X %02X), %u byte payload, %llu frames\n",
+               target.name, target.type[0], target.type[1], target.type[2],
+               target.length, (unsigned long long)stats.frames);
+        if (!stats.frames)
+        {
+            return;
+        }
+
+        std::vector<uint8_t> known_bits(target.length, 0);
+        for (const Field &f : target.known)
+        {
+            known_bits[f.byte] |= ((1u << f.width) - 1) << f.shift;
+        }
+
+        double transitions = stats.transitions ? (double)stats.transitions : 1.0;
+        std::vector<Row> rows;
+
+        for (size_t i = 0; i < target.length; i++)
+        {
+            const char *best = "-";
+            double best_r = 0;
+            for (size_t f = 0; f < target.known.size(); f++)
+            {
+                if (target.known[f].byte == i)
+                {
+                    continue;
+                }
+                double r = stats.Correlation(i, f);
+                if (std::fabs(r) > std::fabs(best_r))
+                {
+                    best_r = r;
+                    best = target.known[f].name;
+                }
+            }
+
+            if (known_bits[i] != 0xff)
+            {
+                rows.push_back({"byte " + std::to_string(i),
+                                Entropy(&stats.histogram[i * 256], 256, stats.frames),
+                                stats.byte_change[i] / transitions, best, best_r});
+            }
+
+            for (uint8_t bit = 0; bit < 8; bit++)
+            {
+                if (known_bits[i] & (1u << bit))
+                {
+                    continue;
+                }
+                const char *bit_best = "-";
+                double bit_best_r = 0;
+                for (size_t f = 0; f < target.known.size(); f++)
+                {
+                    double r = stats.BitCorrelation(i, bit, f);
+                    if (std::fabs(r) > std::fabs(bit_best_r))
+                    {
+                        bit_best_r = r;
+                        bit_best = target.known[f].name;
+                    }
+                }
+
+                uint64_t set = stats.bit_set[i * 8 + bit];
+                uint64_t counts[2] = {stats.frames - set, set};
+                rows.push_back({"byte " + std::to_string(i) + " bit " + std::to_string(bit),
+                                Entropy(counts, 2, stats.frames),
+                                stats.bit_change[i * 8 + bit] / transitions, bit_best, bit_best_r});
+            }
+        }
+
+        std::stable_sort(rows.begin(), rows.end(), [](const Row &a, const Row &b) {
+            if (a.entropy != b.entropy)
+            {
+                return a.entropy > b.entropy;
+            }
+            return a.change > b.change;
+        });
+
+        printf("%-18s %8s %8s  %s\n", "unknown", "entropy", "change", "best correlation");
+        for (const Row &row : rows)
+        {
+            printf("%-18s %8.4f %8.4f  ", row.what.c_str(), row.entropy, row.change);
+            if (row.best && *row.best && std::fabs(row.r) > 0)
+            {
+                printf("%s r=%+.3f", row.best, row.r);
+            }
+            printf("\n");
+        }
+    }
+
+    int Usage(const char *argv0)
+    {
+        fprintf(stderr, "usage: %s [--type status|config|control2|temprange|faultlog] [--jobs N] capture...\n", argv0);
+        return 2;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<Target> targets = Targets();
+    const Target *target = &targets[0];
+    unsigned jobs = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<const char *> paths;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--type") && i + 1 < argc)
+        {
+            const char *name = argv[++i];
+            auto it = std::find_if(targets.begin(), targets.end(),
+                                   [name](const Target &t) { return !strcmp(t.name, name); });
+            if (it == targets.end())
+            {
+                return Usage(argv[0]);
+            }
+            target = &*it;
+        }
+        else if (!strcmp(argv[i], "--jobs") && i + 1 < argc)
+        {
+            jobs = std::max(1, atoi(argv[++i]));
+        }
+        else if (argv[i][0] == '-')
+        {
+            return Usage(argv[0]);
+        }
+        else
+        {
+            paths.push_back(argv[i]);
+        }
+    }
+
+    if (paths.empty())
+    {
+        return Usage(argv[0]);
+    }
+
+    std::vector<Chunk> chunks;
+    for (const char *path : paths)
+    {
+        int fd = open(path, O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) < 0)
+        {
+            perror(path);
+            return 1;
+        }
+        if (st.st_size == 0)
+        {
+            close(fd);
+            continue;
+        }
+
+        void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED)
+        {
+            perror(path);
+            return 1;
+        }
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+        const uint8_t *base = (const uint8_t *)map;
+        const uint8_t *limit = base + st.st_size;
+        for (const uint8_t *p = base; p < limit; p += CHUNK_SIZE)
+        {
+            chunks.push_back({p, std::min(p + CHUNK_SIZE, limit), limit});
+        }
+    }
+
+    jobs = std::min<size_t>(jobs, std::max<size_t>(chunks.size(), 1));
+    std::atomic<size_t> next{0};
+    std::vector<Stats> partial(jobs, Stats(target->length, target->known.size()));
+    std::vector<std::thread> workers;
+
+    for (unsigned j = 0; j < jobs; j++)
+    {
+        workers.emplace_back([&, j]() {
+            for (size_t c = next++; c < chunks.size(); c = next++)
+            {
+                ScanChunk(chunks[c], *target, partial[j]);
+            }
+        });
+    }
+
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+
+    for (unsigned j = 1; j < jobs; j++)
+    {
+        partial[0].Merge(partial[j]);
+    }
+
+    Report(*target, partial[0]);
+    return 0;
+}
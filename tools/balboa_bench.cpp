@@ -0,0 +1,570 @@
+/**
+ * Protocol layer microbenchmarks.
+ *
+ * For every message class: frame serialization, parse plus CRC check and
+ * field decode; for the classes with setters, encode.  Frames too large for
+ * the parser buffer are benchmarked as "drop", the cost of skipping them.
+ * Parse is also run on a synthetic traffic mix and, with --capture, on a
+ * recorded raw capture.
+ *
+ *   g++ -O2 -std=c++17 -I.. balboa_bench.cpp ../balboa_messages.cpp ../balboa_parser.cpp -o balboa_bench
+ *   ./balboa_bench [--capture raw.bin] [--out bench_output.txt]
+ *                  [--baseline bench_baseline.txt [--tolerance 0.25]] [--update]
+ *
+ * Results are written one "name<TAB>ns_per_op" per line, each the median of
+ * 21 rounds of 10 ms.  The benchmarks take their rounds in turn, so changes
+ * in host load and clock spread over all of them instead of skewing a few,
+ * and their inputs sit at page aligned addresses.
+ *
+ * --update rewrites the baseline from five passes: the median, plus the
+ * relative spread between passes as a third column.  With --baseline a
+ * result counts as slower when it exceeds its baseline by more than
+ * `tolerance` or twice its spread, whichever is larger, but never by more
+ * than 50%; slow results are reported and the exit code is 1.  A fixed
+ * calibration loop is timed along with the rest and the baseline is scaled
+ * by it, which absorbs clock and load differences but not a different CPU.
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "balboa_messages.hpp"
+#include "balboa_parser.hpp"
+#include "balboa_tools.hpp"
+
+using namespace balboa;
+
+namespace
+{
+    const uint8_t FRAME_MARK = 0x7e;
+    const size_t FRAMES = 1024;
+
+    template <class T>
+    inline void Keep(const T &value)
+    {
+        asm volatile("" : : "r,m"(value) : "memory");
+    }
+
+    const int UPDATE_PASSES = 5;
+    // Five passes under-sample the spread, so twice it is allowed, but no
+    // result may hide a slowdown of more than NOISE_CAP behind its noise.
+    const double NOISE_SLACK = 2.0;
+    const double NOISE_CAP = 0.5;
+
+    /** Page aligned storage, so inputs land on the same cache sets every run. */
+    template <class T>
+    struct PageAllocator
+    {
+        typedef T value_type;
+
+        PageAllocator() = default;
+        template <class U>
+        PageAllocator(const PageAllocator<U> &) {}
+
+        T *allocate(size_t n)
+        {
+            void *p = aligned_alloc(4096, (n * sizeof(T) + 4095) / 4096 * 4096);
+            if (!p)
+            {
+                throw std::bad_alloc();
+            }
+            return (T *)p;
+        }
+        void deallocate(T *p, size_t) { free(p); }
+
+        template <class U>
+        bool operator==(const PageAllocator<U> &) const { return true; }
+        template <class U>
+        bool operator!=(const PageAllocator<U> &) const { return false; }
+    };
+
+    typedef std::vector<uint8_t, PageAllocator<uint8_t>> Stream;
+
+    std::vector<std::pair<std::string, double>> results;
+    bool quiet = false;
+
+    const int ROUNDS = 21;
+    const double ROUND_NS = 10e6;
+
+    struct Bench
+    {
+        std::string name;
+        size_t ops;
+        std::function<double()> round; // one timed round, ns per call of fn
+        double rounds[ROUNDS];
+    };
+
+    std::vector<Bench> suite;
+
+    /**
+     * Queues `fn`, which performs `ops` operations, for Measure().  `fn` and
+     * whatever it captures must stay valid until then.
+     */
+    template <class F>
+    void Add(const std::string &name, size_t ops, F fn)
+    {
+        Bench bench;
+        bench.name = name;
+        bench.ops = ops;
+        bench.round = [fn]() {
+            size_t iterations = 0;
+            auto start = std::chrono::steady_clock::now();
+            std::chrono::duration<double, std::nano> elapsed{};
+            do
+            {
+                // Batches keep the clock out of the cheap single-op cases.
+                for (int batch = 0; batch < 64; batch++)
+                {
+                    fn();
+                }
+                iterations += 64;
+                elapsed = std::chrono::steady_clock::now() - start;
+            } while (elapsed.count() < ROUND_NS);
+            return elapsed.count() / iterations;
+        };
+        suite.push_back(std::move(bench));
+    }
+
+    /**
+     * Times every queued benchmark for ROUNDS rounds of ROUND_NS, taking
+     * them in turn so that a slow spell of the host hits all of them alike
+     * rather than whichever ran during it, and keeps the median ns/op.
+     */
+    void Measure()
+    {
+        for (int round = 0; round < ROUNDS; round++)
+        {
+            for (Bench &bench : suite)
+            {
+                bench.rounds[round] = bench.round() / bench.ops;
+            }
+        }
+        for (Bench &bench : suite)
+        {
+            std::nth_element(bench.rounds, bench.rounds + ROUNDS / 2, bench.rounds + ROUNDS);
+            results.emplace_back(bench.name, bench.rounds[ROUNDS / 2]);
+            if (!quiet)
+            {
+                printf("%-40s %10.2f ns/op\n", bench.name.c_str(), bench.rounds[ROUNDS / 2]);
+            }
+        }
+        suite.clear();
+    }
+
+    struct Handler : MessageHandler
+    {
+        uint32_t sum = 0;
+
+        void OnReadyToSend(const ReadyToSend::data_type &) override { sum++; }
+        void OnStatus(const Status::data_type &d) override
+        {
+            sum += d.current_temp + d.hour + d.minute + d.heating + d.pump1 + d.pump2 +
+                   d.pump3 + d.circulation_pump + d.blower + d.lights + d.set_temp;
+        }
+        void OnFilterCycles(const FilterCyclesResponse::data_type &d) override
+        {
+            sum += d.filter1_start_hour + d.filter1_duration_hours + d.filter2_enabled;
+        }
+        void OnInformation(const InformationResponse::data_type &d) override
+        {
+            sum += d.software_version[0] + d.signature + d.heater_type;
+        }
+        void OnFaultLog(const FaultLogResponse::data_type &d) override
+        {
+            sum += d.message_code + d.days_ago + d.sensor_a_temp;
+        }
+        void OnControlConfig2(const ControlConfig2Response::data_type &d) override { sum += d.unknown[0]; }
+        void OnConfig(const ConfigResponse::data_type &d) override { sum += d.unknown[0]; }
+        void OnSetTempRange(const SetTempRange::data_type &d) override { sum += d.unknown[0]; }
+        void OnUnhandled(const uint8_t *frame) override { sum += frame[0]; }
+    };
+
+    template <class MS>
+    void RandomFrame(std::mt19937 &rng, Stream &out)
+    {
+        Message<MS> message;
+        uint8_t *payload = (uint8_t *)&message.data;
+        for (uint8_t i = 0; i < MS::length_type::length; i++)
+        {
+            payload[i] = (uint8_t)rng();
+            payload[i] = payload[i] == FRAME_MARK ? 0 : payload[i];
+        }
+        message.SetCRC();
+
+        uint8_t frame[MS::length_type::length + 7];
+        out.insert(out.end(), frame, frame + message.Write(frame));
+    }
+
+    template <class MS>
+    void BenchClass(const char *name, std::mt19937 &rng)
+    {
+        std::string prefix = name;
+
+        Add(prefix + "/serialize", 1, []() {
+            Message<MS> message;
+            message.SetCRC();
+            uint8_t frame[MS::length_type::length + 7];
+            Keep(message.Write(frame));
+            Keep(frame);
+        });
+
+        // Owned by the benchmarks, which run after this returns.
+        auto stream = std::make_shared<Stream>();
+        for (size_t i = 0; i < FRAMES; i++)
+        {
+            RandomFrame<MS>(rng, *stream);
+        }
+
+        // Frames the parser buffer cannot hold are resynced over, byte by byte.
+        bool fits = MS::length_type::length + 7 <= FrameParser::BUFFER_SIZE;
+        Add(prefix + (fits ? "/parse" : "/drop"), FRAMES, [stream]() {
+            static FrameParser parser;
+            Handler handler;
+            Keep(parser.Feed(stream->data(), stream->size(), handler));
+        });
+
+        // Decode only: the frames are already split and checked.
+        auto frames = std::make_shared<std::vector<const uint8_t *, PageAllocator<const uint8_t *>>>();
+        for (size_t pos = 0; pos < stream->size(); pos += (*stream)[pos + 1] + 2)
+        {
+            frames->push_back(&(*stream)[pos + 1]);
+        }
+
+        Add(prefix + "/decode", FRAMES, [stream, frames]() {
+            Handler handler;
+            for (const uint8_t *frame : *frames)
+            {
+                Dispatch(frame, handler);
+            }
+            Keep(handler.sum);
+        });
+    }
+
+    void BenchEncoders()
+    {
+        Add("SettingsRequest/encode", 5, []() {
+            SettingsRequest::data_type data;
+            for (int type = SettingsRequest::PANEL_REQUEST; type <= SettingsRequest::FAULT_LOG_REQUEST; type++)
+            {
+                SettingsRequest::SetSettingsType((SettingsRequest::request_type)type, data);
+                Keep(data);
+            }
+        });
+        Add("ToggleItemRequest/encode", 1, []() {
+            ToggleItemRequest::data_type data;
+            ToggleItemRequest::Toggle(ToggleItemRequest::PUMP1, data);
+            Keep(data);
+        });
+        Add("SetTempRequest/encode", 1, []() {
+            SetTempRequest::data_type data;
+            SetTempRequest::SpaTemp temp{100, false};
+            SetTempRequest::SetTemperature(temp, data);
+            Keep(data);
+        });
+        Add("SetTimeRequest/encode", 1, []() {
+            SetTimeRequest::data_type data;
+            SetTimeRequest::SpaTime time{13, 37, true};
+            SetTimeRequest::SetTime(time, data);
+            Keep(data);
+        });
+        Add("SetTempScaleRequest/encode", 1, []() {
+            SetTempScaleRequest::data_type data;
+            SetTempScaleRequest::SetScale(true, data);
+            Keep(data);
+        });
+        Add("FilterConfigRequest/encode", 1, []() {
+            FilterConfigRequest::data_type data;
+            FilterConfigRequest::SetFilterConfig(data);
+            Keep(data);
+        });
+    }
+
+    void BenchStream(const char *name, Stream data)
+    {
+        auto stream = std::make_shared<Stream>(std::move(data));
+        FrameParser counter;
+        Handler handler;
+        size_t frames = counter.Feed(stream->data(), stream->size(), handler);
+        if (!frames)
+        {
+            fprintf(stderr, "%s: no frames\n", name);
+            return;
+        }
+
+        Add(std::string(name) + "/parse", frames, [stream]() {
+            static FrameParser parser;
+            Handler handler;
+            for (size_t pos = 0; pos < stream->size(); pos += 64)
+            {
+                parser.Feed(&(*stream)[pos], std::min<size_t>(64, stream->size() - pos), handler);
+            }
+            Keep(handler.sum);
+        });
+    }
+
+    /** Status and clear-to-send dominate, with the odd poll and line noise. */
+    Stream SyntheticMix(std::mt19937 &rng)
+    {
+        Stream stream;
+        for (size_t i = 0; i < 16 * FRAMES; i++)
+        {
+            unsigned pick = rng() % 100;
+            if (pick < 45)
+            {
+                RandomFrame<Status>(rng, stream);
+            }
+            else if (pick < 90)
+            {
+                RandomFrame<ReadyToSend>(rng, stream);
+            }
+            else if (pick < 95)
+            {
+                RandomFrame<SettingsRequest>(rng, stream);
+            }
+            else if (pick < 98)
+            {
+                RandomFrame<FilterCyclesResponse>(rng, stream);
+            }
+            else
+            {
+                for (unsigned n = rng() % 8; n; n--)
+                {
+                    stream.push_back((uint8_t)rng());
+                }
+            }
+        }
+        return stream;
+    }
+
+    /** Reads "name ns [noise]" lines; noise is the relative spread seen by --update. */
+    std::map<std::string, double> ReadResults(const char *path, std::map<std::string, double> &noise)
+    {
+        std::map<std::string, double> values;
+        FILE *file = fopen(path, "r");
+        char line[256];
+        char name[128];
+        double value;
+        double spread;
+        while (file && fgets(line, sizeof(line), file))
+        {
+            int fields = sscanf(line, "%127s %lf %lf", name, &value, &spread);
+            if (fields >= 2)
+            {
+                values[name] = value;
+            }
+            if (fields == 3)
+            {
+                noise[name] = spread;
+            }
+        }
+        if (file)
+        {
+            fclose(file);
+        }
+        return values;
+    }
+
+    bool WriteResults(const char *path, const std::map<std::string, double> *noise = nullptr)
+    {
+        FILE *file = fopen(path, "w");
+        if (!file)
+        {
+            perror(path);
+            return false;
+        }
+        for (const auto &result : results)
+        {
+            fprintf(file, "%s\t%.3f", result.first.c_str(), result.second);
+            if (noise && noise->count(result.first))
+            {
+                fprintf(file, "\t%.3f", noise->at(result.first));
+            }
+            fprintf(file, "\n");
+        }
+        return fclose(file) == 0;
+    }
+
+    void RunSuite(const Stream &replay)
+    {
+        std::mt19937 rng(0xba1b0a);
+        results.clear();
+
+        // Machine speed reference, baselines are compared relative to it.
+        Add("calibrate", 256, []() {
+            uint32_t x = 1;
+            for (int i = 0; i < 256; i++)
+            {
+                x = x * 1664525u + 1013904223u;
+                Keep(x);
+            }
+        });
+
+        BenchEncoders();
+
+        BenchClass<ConfigRequest>("ConfigRequest", rng);
+        BenchClass<ToggleItemRequest>("ToggleItemRequest", rng);
+        BenchClass<SetTempRequest>("SetTempRequest", rng);
+        BenchClass<SetTimeRequest>("SetTimeRequest", rng);
+        BenchClass<FilterConfigRequest>("FilterConfigRequest", rng);
+        BenchClass<SettingsRequest>("SettingsRequest", rng);
+        BenchClass<SetFilterConfigRequest>("SetFilterConfigRequest", rng);
+        BenchClass<SetTempScaleRequest>("SetTempScaleRequest", rng);
+        BenchClass<SetWiFiSettingsRequest>("SetWiFiSettingsRequest", rng);
+        BenchClass<ReadyToSend>("ReadyToSend", rng);
+        BenchClass<Status>("Status", rng);
+        BenchClass<FilterCyclesResponse>("FilterCyclesResponse", rng);
+        BenchClass<InformationResponse>("InformationResponse", rng);
+        BenchClass<FaultLogResponse>("FaultLogResponse", rng);
+        BenchClass<ControlConfig2Response>("ControlConfig2Response", rng);
+        BenchClass<ConfigResponse>("ConfigResponse", rng);
+        BenchClass<SetTempRange>("SetTempRange", rng);
+
+        BenchStream("mix/synthetic", SyntheticMix(rng));
+
+        if (!replay.empty())
+        {
+            BenchStream("mix/capture", replay);
+        }
+
+        Measure();
+    }
+
+    /**
+     * Names of the results slower than their scaled baseline by more than
+     * `tolerance` or, if larger, NOISE_SLACK times their recorded spread
+     * capped at NOISE_CAP.
+     */
+    std::vector<std::string> Regressions(const std::map<std::string, double> &old,
+                                         const std::map<std::string, double> &noise, double tolerance)
+    {
+        auto calibrate = old.find("calibrate");
+        double scale = calibrate != old.end() ? results[0].second / calibrate->second : 1.0;
+        std::vector<std::string> slow;
+        for (const auto &result : results)
+        {
+            auto it = old.find(result.first);
+            if (it == old.end())
+            {
+                continue;
+            }
+            auto spread = noise.find(result.first);
+            double slack = spread != noise.end() ? std::min(NOISE_CAP, NOISE_SLACK * spread->second) : 0.0;
+            double allowed = std::max(tolerance, slack);
+            if (result.second > it->second * scale * (1 + allowed))
+            {
+                slow.push_back(result.first);
+            }
+        }
+        return slow;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *capture = nullptr;
+    const char *out = "bench_output.txt";
+    const char *baseline = nullptr;
+    double tolerance = 0.25;
+    bool update = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--capture") && i + 1 < argc)
+        {
+            capture = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--out") && i + 1 < argc)
+        {
+            out = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--baseline") && i + 1 < argc)
+        {
+            baseline = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--tolerance") && i + 1 < argc)
+        {
+            tolerance = atof(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--update"))
+        {
+            update = true;
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [--capture raw.bin] [--out file] [--baseline file [--tolerance 0.25]] [--update]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    Stream replay;
+    if (capture)
+    {
+        LoadFile(capture, replay);
+    }
+    RunSuite(replay);
+
+    if (!WriteResults(out))
+    {
+        return 1;
+    }
+
+    if (baseline && update)
+    {
+        // The baseline is the median of a few passes and keeps their
+        // spread, so a result that is noisier than most is not flagged for it.
+        std::vector<std::vector<double>> samples(results.size());
+        for (int pass = 0; pass < UPDATE_PASSES; pass++)
+        {
+            if (pass)
+            {
+                quiet = true;
+                RunSuite(replay);
+            }
+            for (size_t i = 0; i < results.size(); i++)
+            {
+                samples[i].push_back(results[i].second);
+            }
+        }
+
+        std::map<std::string, double> noise;
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            std::vector<double> &values = samples[i];
+            std::sort(values.begin(), values.end());
+            results[i].second = values[values.size() / 2];
+            noise[results[i].first] = (values.back() - values.front()) / results[i].second;
+        }
+        return WriteResults(baseline, &noise) ? 0 : 1;
+    }
+
+    size_t regressions = 0;
+    if (baseline)
+    {
+        std::map<std::string, double> noise;
+        std::map<std::string, double> old = ReadResults(baseline, noise);
+        std::vector<std::string> slow = Regressions(old, noise, tolerance);
+
+        double scale = old.count("calibrate") ? results[0].second / old["calibrate"] : 1.0;
+        printf("machine speed factor %.2f\n", scale);
+        for (const auto &result : results)
+        {
+            if (std::find(slow.begin(), slow.end(), result.first) != slow.end())
+            {
+                printf("REGRESSION %s: %.2f -> %.2f ns/op\n", result.first.c_str(), old[result.first] * scale,
+                       result.second);
+            }
+        }
+        regressions = slow.size();
+        printf("%zu regression(s) against %s\n", regressions, baseline);
+    }
+
+    return regressions ? 1 : 0;
+}
@@ -0,0 +1,194 @@
+/**
+ * Host side converter for the capture container in balboa_capture.hpp.
+ *
+ *   g++ -O2 -std=c++17 -I.. balboa_capture.cpp ../balboa_capture.cpp ../balboa_messages.cpp -o balboa_capture
+ *   ./balboa_capture pack raw.bin out.bbc [--baud 115200]
+ *   ./balboa_capture unpack in.bbc raw.bin [--from MS]
+ *   ./balboa_capture stat in.bbc
+ *
+ * Raw captures have no timestamps, pack derives them from the byte position
+ * at the given baud rate (10 bits per byte on the wire).
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "balboa_capture.hpp"
+#include "balboa_messages.hpp"
+
+using namespace balboa;
+
+namespace
+{
+    const uint8_t FRAME_MARK = 0x7e;
+
+    class FileSink : public CaptureSink
+    {
+    public:
+        explicit FileSink(FILE *file) : _file(file) {}
+
+        bool Write(const uint8_t *data, size_t length) override
+        {
+            return fwrite(data, 1, length, _file) == length;
+        }
+
+    private:
+        FILE *_file;
+    };
+
+    const uint8_t *Map(const char *path, size_t &size)
+    {
+        int fd = open(path, O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) < 0)
+        {
+            perror(path);
+            return nullptr;
+        }
+
+        size = st.st_size;
+        void *map = size ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+        close(fd);
+        if (map == MAP_FAILED || !map)
+        {
+            fprintf(stderr, "%s: cannot map\n", path);
+            return nullptr;
+        }
+        return (const uint8_t *)map;
+    }
+
+    int Pack(const char *in, const char *out, unsigned baud)
+    {
+        size_t size;
+        const uint8_t *data = Map(in, size);
+        FILE *file = data ? fopen(out, "wb") : nullptr;
+        if (!file)
+        {
+            return 1;
+        }
+
+        // The writer holds a 4 KiB block and the slot table, keep it off the stack.
+        FileSink sink(file);
+        std::unique_ptr<CaptureWriter> owner(new CaptureWriter(sink, true));
+        CaptureWriter &writer = *owner;
+        size_t frames = 0;
+        writer.Begin();
+
+        for (const uint8_t *p = data; (p = FindFrame(p, data + size)); p += p[1] + 2)
+        {
+            writer.Add((uint64_t)(p - data) * 10000 / baud, p + 1);
+            frames++;
+        }
+
+        bool ok = writer.Finish();
+        ok = fclose(file) == 0 && ok;
+        printf("%zu frames, %zu -> %llu bytes (%.1fx)\n", frames, size,
+               (unsigned long long)writer.written(), (double)size / writer.written());
+        return ok ? 0 : 1;
+    }
+
+    int Unpack(const char *in, const char *out, uint64_t from)
+    {
+        size_t size;
+        const uint8_t *data = Map(in, size);
+        static CaptureReader reader;
+        if (!data || !reader.Open(data, size))
+        {
+            fprintf(stderr, "%s: not a capture\n", in);
+            return 1;
+        }
+
+        FILE *file = fopen(out, "wb");
+        if (!file)
+        {
+            perror(out);
+            return 1;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        uint8_t frame[258];
+        uint64_t timestamp;
+        size_t frames = 0;
+        if (from)
+        {
+            reader.Seek(from);
+        }
+
+        while (reader.Next(timestamp, frame + 1))
+        {
+            frame[0] = FRAME_MARK;
+            frame[frame[1] + 1] = FRAME_MARK;
+            fwrite(frame, 1, frame[1] + 2, file);
+            frames++;
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        fclose(file);
+        printf("%zu frames from %zu blocks in %.3f s\n", frames, reader.blocks(), seconds);
+        return 0;
+    }
+
+    int Stat(const char *in)
+    {
+        size_t size;
+        const uint8_t *data = Map(in, size);
+        static CaptureReader reader;
+        if (!data || !reader.Open(data, size))
+        {
+            fprintf(stderr, "%s: not a capture\n", in);
+            return 1;
+        }
+
+        uint8_t frame[256];
+        uint64_t timestamp, first = 0, last = 0;
+        size_t frames = 0, raw = 0;
+        while (reader.Next(timestamp, frame))
+        {
+            first = frames ? first : timestamp;
+            last = timestamp;
+            raw += frame[0] + 2;
+            frames++;
+        }
+
+        printf("%zu bytes, %zu blocks, %zu frames, %zu raw bytes (%.1fx), %llu..%llu ms\n",
+               size, reader.blocks(), frames, raw, size ? (double)raw / size : 0.0,
+               (unsigned long long)first, (unsigned long long)last);
+        return 0;
+    }
+
+    int Usage(const char *argv0)
+    {
+        fprintf(stderr,
+                "usage: %s pack raw.bin out.bbc [--baud N]\n"
+                "       %s unpack in.bbc raw.bin [--from MS]\n"
+                "       %s stat in.bbc\n",
+                argv0, argv0, argv0);
+        return 2;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc >= 4 && !strcmp(argv[1], "pack"))
+    {
+        unsigned baud = argc >= 6 && !strcmp(argv[4], "--baud") ? atoi(argv[5]) : 115200;
+        return baud ? Pack(argv[2], argv[3], baud) : Usage(argv[0]);
+    }
+    if (argc >= 4 && !strcmp(argv[1], "unpack"))
+    {
+        uint64_t from = argc >= 6 && !strcmp(argv[4], "--from") ? strtoull(argv[5], nullptr, 10) : 0;
+        return Unpack(argv[2], argv[3], from);
+    }
+    if (argc == 3 && !strcmp(argv[1], "stat"))
+    {
+        return Stat(argv[2]);
+    }
+    return Usage(argv[0]);
+}
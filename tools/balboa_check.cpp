@@ -0,0 +1,396 @@
+/**
+ * Host side checks for the on-device bookkeeping: energy, filter schedule,
+ * fault log and capture container.
+ *
+ *   g++ -O2 -std=c++17 -I.. balboa_check.cpp ../balboa_capture.cpp ../balboa_energy.cpp ../balboa_fault_log.cpp ../balboa_filter.cpp ../balboa_messages.cpp -o balboa_check
+ *   ./balboa_check
+ *
+ * Each check feeds a scripted sequence of frames and compares the result
+ * with numbers worked out by hand.  Failures are listed with their line and
+ * the exit code is 1.
+ */
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "balboa_capture.hpp"
+#include "balboa_energy.hpp"
+#include "balboa_fault_log.hpp"
+#include "balboa_filter.hpp"
+#include "balboa_messages.hpp"
+
+using namespace balboa;
+
+namespace
+{
+    int failures = 0;
+
+#define CHECK(condition)                                                                  \
+    do                                                                                    \
+    {                                                                                     \
+        if (!(condition))                                                                 \
+        {                                                                                 \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            failures++;                                                                   \
+        }                                                                                 \
+    } while (0)
+
+    /*****************************************************************
+    **************************ENERGY**********************************
+    ******************************************************************/
+
+    /** Feeds `status` every `step_ms` for `duration_ms`, starting at `now_ms`. */
+    uint32_t Hold(EnergyMeter &meter, uint32_t now_ms, uint32_t duration_ms, uint32_t step_ms,
+                  const EnergyMeter::Calendar &calendar, const Status::data_type &status)
+    {
+        for (uint32_t t = 0; t < duration_ms; t += step_ms)
+        {
+            meter.Update(now_ms + t, calendar, status);
+        }
+        return now_ms + duration_ms;
+    }
+
+    void CheckEnergy()
+    {
+        const EnergyMeter::Calendar day1 = {{100, 10, 1}};
+        Status::data_type off = {};
+
+        // Lights report 0b11 when on and must count as level 1.
+        {
+            EnergyMeter meter;
+            meter.SetWatts(EnergyMeter::LIGHTS, 1, 10);
+            Status::data_type lights = off;
+            lights.lights = 3;
+            uint32_t now = Hold(meter, 0, 3600 * 1000, 1000, day1, lights);
+            meter.Update(now, day1, off);
+            CHECK(meter.current(EnergyMeter::DAY).seconds[EnergyMeter::LIGHTS] == 3600);
+            CHECK(meter.current(EnergyMeter::DAY).watt_hours[EnergyMeter::LIGHTS] == 10);
+        }
+
+        // Pump speed selects the wattage; odd frame spacing leaves no rounding loss.
+        {
+            EnergyMeter meter;
+            meter.SetWatts(EnergyMeter::PUMP1, 1, 300);
+            meter.SetWatts(EnergyMeter::PUMP1, 2, 2000);
+            Status::data_type high = off;
+            high.pump1 = 2;
+            uint32_t now = Hold(meter, 0, 1800 * 1000, 1300, day1, high);
+            meter.Update(now, day1, off);
+            CHECK(meter.current(EnergyMeter::HOUR).seconds[EnergyMeter::PUMP1] == 1800);
+            CHECK(meter.current(EnergyMeter::HOUR).watt_hours[EnergyMeter::PUMP1] == 1000);
+            CHECK(meter.current(EnergyMeter::HOUR).seconds[EnergyMeter::PUMP2] == 0);
+        }
+
+        // A gap longer than MAX_GAP_MS (bus lost) is not charged.
+        {
+            EnergyMeter meter;
+            meter.SetWatts(EnergyMeter::HEATER, 1, 4000);
+            Status::data_type heating = off;
+            heating.heating = 1;
+            meter.Update(0, day1, heating);
+            meter.Update(EnergyMeter::MAX_GAP_MS + 1, day1, heating);
+            meter.Update(EnergyMeter::MAX_GAP_MS + 1001, day1, off);
+            CHECK(meter.current(EnergyMeter::DAY).seconds[EnergyMeter::HEATER] == 1);
+        }
+
+        // A new period number starts the bucket over and keeps the last one.
+        // The frame that brings the new number charges its interval to it.
+        {
+            EnergyMeter meter;
+            meter.SetWatts(EnergyMeter::BLOWER, 3, 900);
+            Status::data_type blower = off;
+            blower.blower = 3;
+            uint32_t now = Hold(meter, 0, 4000 * 1000, 1000, day1, blower);
+            const EnergyMeter::Calendar day2 = {{101, 11, 1}};
+            now = Hold(meter, now, 2000 * 1000, 1000, day2, blower);
+            meter.Update(now, day2, off);
+            CHECK(meter.previous(EnergyMeter::DAY).key == 10);
+            CHECK(meter.previous(EnergyMeter::DAY).seconds[EnergyMeter::BLOWER] == 3999);
+            CHECK(meter.current(EnergyMeter::DAY).seconds[EnergyMeter::BLOWER] == 2001);
+            // 999.75 Wh, then 500.25 Wh plus the 0.75 Wh carried over.
+            CHECK(meter.previous(EnergyMeter::DAY).watt_hours[EnergyMeter::BLOWER] == 999);
+            CHECK(meter.current(EnergyMeter::DAY).watt_hours[EnergyMeter::BLOWER] == 501);
+            CHECK(meter.current(EnergyMeter::MONTH).seconds[EnergyMeter::BLOWER] == 6000);
+        }
+    }
+
+    /*****************************************************************
+    **************************FILTER**********************************
+    ******************************************************************/
+
+    Status::data_type At(uint8_t hour, uint8_t minute, uint8_t running)
+    {
+        Status::data_type status = {};
+        status.hour = hour;
+        status.minute = minute;
+        status.filter1_running = running & FilterSchedule::FILTER1 ? 1 : 0;
+        status.filter2_running = running & FilterSchedule::FILTER2 ? 1 : 0;
+        return status;
+    }
+
+    void CheckFilter()
+    {
+        // Filter 1 22:30 for 2h (across midnight), filter 2 12:00 for 1h.
+        FilterCyclesResponse::data_type cycles = {};
+        cycles.filter1_start_hour = 22;
+        cycles.filter1_start_minute = 30;
+        cycles.filter1_duration_hours = 2;
+        cycles.filter2_enabled = 1;
+        cycles.filter2_start_hour = 12;
+        cycles.filter2_duration_hours = 1;
+
+        FilterSchedule schedule;
+        CHECK(!schedule.valid());
+        CHECK(schedule.Set(cycles));
+        CHECK(schedule.valid());
+        CHECK(!schedule.Set(cycles));
+
+        CHECK(schedule.Active(22 * 60 + 29) == 0);
+        CHECK(schedule.Active(23 * 60) == FilterSchedule::FILTER1);
+        CHECK(schedule.Active(29) == FilterSchedule::FILTER1);
+        CHECK(schedule.Active(30) == 0);
+        CHECK(schedule.Active(12 * 60 + 59) == FilterSchedule::FILTER2);
+
+        uint16_t until = 0;
+        FilterSchedule::Filter filter = FilterSchedule::FILTER1;
+        CHECK(schedule.Next(13 * 60, until, filter) && until == 570 && filter == FilterSchedule::FILTER1);
+        CHECK(schedule.Next(60, until, filter) && until == 660 && filter == FilterSchedule::FILTER2);
+        CHECK(schedule.Next(12 * 60, until, filter) && until == 0 && filter == FilterSchedule::FILTER2);
+
+        // Drift folds into -720..719 across midnight.
+        CHECK(FilterSchedule::Drift(At(0, 5, 0), 23, 55) == 10);
+        CHECK(FilterSchedule::Drift(At(23, 55, 0), 0, 5) == -10);
+        CHECK(FilterSchedule::Drift(At(12, 0, 0), 0, 0) == -720);
+
+        // Either state is accepted a minute around an edge, not inside the window.
+        CHECK(schedule.Check(At(22, 29, FilterSchedule::FILTER1)));
+        CHECK(schedule.Check(At(0, 30, FilterSchedule::FILTER1)));
+        for (uint8_t i = 1; i < FilterSchedule::MISMATCH_LIMIT; i++)
+        {
+            CHECK(schedule.Check(At(23, 0, 0)));
+        }
+        CHECK(schedule.Check(At(23, 0, FilterSchedule::FILTER1)));
+        for (uint8_t i = 1; i < FilterSchedule::MISMATCH_LIMIT; i++)
+        {
+            schedule.Check(At(23, 0, 0));
+        }
+        CHECK(!schedule.Check(At(23, 0, 0)));
+        CHECK(!schedule.valid());
+
+        // The same cycles after going stale are reported unchanged, new ones are not.
+        CHECK(!schedule.Set(cycles));
+        CHECK(schedule.valid());
+        cycles.filter2_enabled = 0;
+        CHECK(schedule.Set(cycles));
+        CHECK(schedule.Active(12 * 60) == 0);
+    }
+
+    /*****************************************************************
+    **************************FAULTS**********************************
+    ******************************************************************/
+
+    FaultLogResponse::data_type Fault(uint8_t code, uint8_t days_ago, uint8_t hours, uint8_t minutes,
+                                      uint8_t sensor_a = 100)
+    {
+        FaultLogResponse::data_type data = {};
+        data.fault_count = FaultLogIndex::CAPACITY;
+        data.message_code = code;
+        data.days_ago = days_ago;
+        data.hours = hours;
+        data.minutes = minutes;
+        data.set_temperature = 100;
+        data.sensor_a_temp = sensor_a;
+        data.sensor_b_temp = 100;
+        return data;
+    }
+
+    void CheckFaults()
+    {
+        const uint32_t today = 20000;
+        const uint32_t midnight = today * 24 * 60;
+
+        // Pinned to today, or yesterday for a time later than the spa clock.
+        {
+            FaultLogIndex index;
+            CHECK(index.Add(Fault(FaultLogIndex::LOW_FLOW, 0, 9, 30), today, 10 * 60));
+            CHECK(index.Add(Fault(FaultLogIndex::LOW_FLOW, 0, 23, 50), today, 10 * 60));
+            CHECK(index.Add(Fault(FaultLogIndex::HEATER_DRY, 2, 8, 0), today, 10 * 60));
+            CHECK(index.size() == 3);
+            CHECK(index[0].minute == midnight - 2 * 24 * 60 + 8 * 60);
+            CHECK(index[1].minute == midnight - 10);
+            CHECK(index[2].minute == midnight + 9 * 60 + 30);
+            CHECK(index.dirty());
+        }
+
+        // A re-read entry is not stored twice, even a minute off after a clock
+        // set or a day later; a different reading at the same time is kept.
+        {
+            FaultLogIndex index;
+            CHECK(index.Add(Fault(FaultLogIndex::LOW_FLOW, 0, 9, 30), today, 10 * 60));
+            index.clean();
+            CHECK(!index.Add(Fault(FaultLogIndex::LOW_FLOW, 0, 9, 30), today, 10 * 60));
+            CHECK(!index.Add(Fault(FaultLogIndex::LOW_FLOW, 0, 9, 31), today, 10 * 60));
+            CHECK(!index.Add(Fault(FaultLogIndex::LOW_FLOW, 1, 9, 30), today + 1, 10 * 60));
+            CHECK(!index.dirty());
+            CHECK(index.Add(Fault(FaultLogIndex::LOW_FLOW, 0, 9, 30, 101), today, 10 * 60));
+            CHECK(index.size() == 2);
+        }
+
+        // When full the oldest goes, and anything older is refused.
+        {
+            FaultLogIndex index;
+            for (uint8_t i = 0; i < FaultLogIndex::CAPACITY; i++)
+            {
+                CHECK(index.Add(Fault(FaultLogIndex::SENSOR_A_FAULT, 0, i % 24, i / 24), today, 23 * 60 + 59));
+            }
+            CHECK(index.size() == FaultLogIndex::CAPACITY);
+            CHECK(!index.Add(Fault(FaultLogIndex::LOW_FLOW, 1, 12, 0), today, 23 * 60 + 59));
+            CHECK(index.Add(Fault(FaultLogIndex::LOW_FLOW, 0, 23, 30), today, 23 * 60 + 59));
+            CHECK(index.size() == FaultLogIndex::CAPACITY);
+            CHECK(index[0].minute == midnight + 60);
+            CHECK(index[FaultLogIndex::CAPACITY - 1].minute == midnight + 23 * 60 + 30);
+        }
+
+        // Time window and code index queries, the code index survives a reload.
+        {
+            FaultLogIndex index;
+            index.Add(Fault(FaultLogIndex::LOW_FLOW, 3, 10, 0), today, 12 * 60);
+            index.Add(Fault(FaultLogIndex::WATER_TOO_HOT, 2, 10, 0), today, 12 * 60);
+            index.Add(Fault(FaultLogIndex::LOW_FLOW, 1, 10, 0), today, 12 * 60);
+            index.Add(Fault(FaultLogIndex::LOW_FLOW, 0, 10, 0), today, 12 * 60);
+
+            FaultLogIndex reloaded;
+            reloaded.stored() = index.stored();
+            reloaded.Loaded();
+
+            FaultLogIndex::Entry found[FaultLogIndex::CAPACITY];
+            CHECK(reloaded.Query(midnight - 2 * 24 * 60, midnight, found, FaultLogIndex::CAPACITY) == 2);
+            CHECK(found[0].message_code == FaultLogIndex::WATER_TOO_HOT);
+            CHECK(reloaded.Query(FaultLogIndex::LOW_FLOW, midnight - 2 * 24 * 60, UINT32_MAX, found,
+                                 FaultLogIndex::CAPACITY) == 2);
+            CHECK(found[0].minute == midnight - 24 * 60 + 10 * 60);
+            CHECK(found[1].minute == midnight + 10 * 60);
+            CHECK(reloaded.Query(FaultLogIndex::LOW_FLOW, 0, UINT32_MAX, found, 1) == 1);
+            CHECK(reloaded.Query(FaultLogIndex::HEATER_DRY, 0, UINT32_MAX, found, FaultLogIndex::CAPACITY) == 0);
+        }
+    }
+
+    /*****************************************************************
+    **************************CAPTURE*********************************
+    ******************************************************************/
+
+    class MemorySink : public CaptureSink
+    {
+    public:
+        bool Write(const uint8_t *data, size_t length) override
+        {
+            bytes.insert(bytes.end(), data, data + length);
+            return true;
+        }
+
+        std::vector<uint8_t> bytes;
+    };
+
+    /** A Status-sized frame whose payload changes with `i`, so blocks fill up. */
+    const uint8_t *Frame(uint32_t i)
+    {
+        static uint8_t frame[29];
+        memset(frame, 0, sizeof(frame));
+        frame[0] = sizeof(frame) - 1;
+        frame[1] = 0xff;
+        frame[2] = 0xaf;
+        frame[3] = 0x13;
+        frame[4] = (uint8_t)i;
+        frame[5] = (uint8_t)(i >> 8);
+        frame[6] = (uint8_t)(i * 37);
+        frame[frame[0]] = CalcCRC(frame, frame[0] - 1);
+        return frame;
+    }
+
+    size_t CountFrom(const std::vector<uint8_t> &bytes, uint64_t from, uint64_t &first)
+    {
+        CaptureReader reader;
+        uint8_t frame[256];
+        uint64_t timestamp;
+        size_t frames = 0;
+        if (!reader.Open(bytes.data(), bytes.size()) || !reader.Seek(from))
+        {
+            return 0;
+        }
+        while (reader.Next(timestamp, frame))
+        {
+            if (!frames++)
+            {
+                first = timestamp;
+            }
+        }
+        return frames;
+    }
+
+    void CheckCapture()
+    {
+        // Many blocks starting at the same time, as a clock step back leaves
+        // them; Seek() must not skip the earlier ones.
+        for (bool index : {false, true})
+        {
+            MemorySink sink;
+            CaptureWriter writer(sink, index);
+            CHECK(writer.Begin());
+            uint32_t i = 0;
+            for (; i < 10; i++)
+            {
+                writer.Add(i, Frame(i));
+            }
+            for (; i < 2000; i++)
+            {
+                writer.Add(1000, Frame(i));
+            }
+            CHECK(writer.Finish());
+
+            CaptureReader reader;
+            CHECK(reader.Open(sink.bytes.data(), sink.bytes.size()) && reader.blocks() > 2);
+            uint64_t first = 0;
+            CHECK(CountFrom(sink.bytes, 1000, first) == 1990 && first == 1000);
+            CHECK(CountFrom(sink.bytes, 5, first) == 1995 && first == 5);
+            CHECK(CountFrom(sink.bytes, 1001, first) == 0);
+        }
+
+        // A step back is clamped, the frames keep their order.
+        {
+            MemorySink sink;
+            CaptureWriter writer(sink);
+            writer.Begin();
+            writer.Add(5000, Frame(1));
+            writer.Add(4000, Frame(2));
+            writer.Add(5100, Frame(3));
+            writer.Finish();
+
+            CaptureReader reader;
+            uint8_t frame[256];
+            uint64_t timestamp[3] = {};
+            CHECK(reader.Open(sink.bytes.data(), sink.bytes.size()));
+            for (uint64_t &t : timestamp)
+            {
+                CHECK(reader.Next(t, frame));
+            }
+            CHECK(timestamp[0] == 5000 && timestamp[1] == 5000 && timestamp[2] == 5100);
+            CHECK(frame[4] == 3);
+        }
+    }
+}
+
+int main()
+{
+    CheckEnergy();
+    CheckFilter();
+    CheckFaults();
+    CheckCapture();
+
+    if (failures)
+    {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
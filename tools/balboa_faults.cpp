@@ -0,0 +1,206 @@
+/**
+ * Merges the fault log indexes of many spas into one timeline.
+ *
+ *   g++ -O2 -std=c++17 -I.. balboa_faults.cpp ../balboa_fault_log.cpp ../balboa_messages.cpp -o balboa_faults
+ *   ./balboa_faults [--code N] [--from MINUTE] [--to MINUTE] [--demo DIR] spa1.bin spa2.bin ...
+ *
+ * Each input is a FaultLogIndex::Stored blob as saved to flash.  The blobs
+ * are already sorted by minute, so the merge is a k-way heap merge that never
+ * looks at an entry twice; with --code each spa is narrowed through its code
+ * index first.  Output is CSV: spa,minute,day,time,code,set,sensor_a,sensor_b.
+ *
+ * Minutes count from 1970-01-01, which is what lets spas be merged at all.
+ * A blob with entries before 2000 or after tomorrow was not dated that way
+ * (or is corrupt) and is refused.
+ *
+ * --demo DIR writes a few generated blobs to DIR to try it out.
+ */
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <queue>
+#include <string>
+#include <vector>
+
+#include "balboa_fault_log.hpp"
+#include "balboa_messages.hpp"
+
+using namespace balboa;
+
+namespace
+{
+    struct Spa
+    {
+        const char *name;
+        std::vector<FaultLogIndex::Entry> entries;
+        size_t next = 0;
+    };
+
+    const uint32_t MINUTES_PER_DAY = 24 * 60;
+    const uint32_t FIRST_DAY = 10957; // 2000-01-01
+
+    uint32_t Today()
+    {
+        return (uint32_t)(time(nullptr) / (24 * 60 * 60));
+    }
+
+    bool Load(const char *path, FaultLogIndex &index)
+    {
+        FILE *file = fopen(path, "rb");
+        if (!file)
+        {
+            perror(path);
+            return false;
+        }
+        size_t got = fread(&index.stored(), 1, sizeof(FaultLogIndex::Stored), file);
+        fclose(file);
+        if (got != sizeof(FaultLogIndex::Stored))
+        {
+            fprintf(stderr, "%s: not a fault log (%zu bytes)\n", path, got);
+            return false;
+        }
+        index.Loaded();
+
+        const uint32_t last = Today() + 1;
+        for (uint8_t i = 0; i < index.size(); i++)
+        {
+            uint32_t day = index[i].minute / MINUTES_PER_DAY;
+            if (day < FIRST_DAY || day > last || (i && index[i].minute < index[i - 1].minute))
+            {
+                fprintf(stderr, "%s: entry %u out of order or not dated in days since 1970 (day %u)\n", path, i, day);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    int Demo(const char *directory)
+    {
+        srand(1);
+        const uint32_t today = Today();
+        for (int spa = 0; spa < 4; spa++)
+        {
+            FaultLogIndex index;
+            for (int i = 0; i < 24; i++)
+            {
+                static const uint8_t CODES[] = {15, 16, 17, 26, 27, 29, 30, 31, 32};
+                FaultLogResponse::data_type data = {};
+                data.fault_count = 24;
+                data.entry_number = (uint8_t)i;
+                data.message_code = CODES[rand() % sizeof(CODES)];
+                data.days_ago = (uint8_t)(rand() % 30);
+                data.hours = (uint8_t)(rand() % 24);
+                data.minutes = (uint8_t)(rand() % 60);
+                data.set_temperature = 100;
+                data.sensor_a_temp = (uint8_t)(95 + rand() % 10);
+                data.sensor_b_temp = (uint8_t)(95 + rand() % 10);
+                index.Add(data, today, 12 * 60);
+            }
+
+            std::string path = std::string(directory) + "/spa" + std::to_string(spa) + ".bin";
+            FILE *file = fopen(path.c_str(), "wb");
+            if (!file)
+            {
+                perror(path.c_str());
+                return 1;
+            }
+            fwrite(&index.stored(), sizeof(FaultLogIndex::Stored), 1, file);
+            fclose(file);
+            printf("%s: %u entries\n", path.c_str(), index.size());
+        }
+        return 0;
+    }
+
+    int Usage(const char *argv0)
+    {
+        fprintf(stderr,
+                "usage: %s [--code N] [--from MINUTE] [--to MINUTE] spa.bin...\n"
+                "       %s --demo DIR\n",
+                argv0, argv0);
+        return 2;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int code = -1;
+    uint32_t from = 0;
+    uint32_t to = UINT32_MAX;
+    std::vector<Spa> spas;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--code") && i + 1 < argc)
+        {
+            code = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--from") && i + 1 < argc)
+        {
+            from = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "--to") && i + 1 < argc)
+        {
+            to = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "--demo") && i + 1 < argc)
+        {
+            return Demo(argv[i + 1]);
+        }
+        else if (argv[i][0] == '-')
+        {
+            return Usage(argv[0]);
+        }
+        else
+        {
+            FaultLogIndex index;
+            if (!Load(argv[i], index))
+            {
+                return 1;
+            }
+            Spa spa;
+            spa.name = argv[i];
+            spa.entries.resize(FaultLogIndex::CAPACITY);
+            size_t found = code < 0 ? index.Query(from, to, spa.entries.data(), spa.entries.size())
+                                    : index.Query((uint8_t)code, from, to, spa.entries.data(), spa.entries.size());
+            spa.entries.resize(found);
+            spas.push_back(std::move(spa));
+        }
+    }
+    if (spas.empty())
+    {
+        return Usage(argv[0]);
+    }
+
+    // Heap of (minute, spa); ties go to the spa given first.
+    typedef std::pair<uint32_t, size_t> Head;
+    std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+    for (size_t s = 0; s < spas.size(); s++)
+    {
+        if (!spas[s].entries.empty())
+        {
+            heads.push(Head((uint32_t)spas[s].entries[0].minute, s));
+        }
+    }
+
+    printf("spa,minute,day,time,code,set,sensor_a,sensor_b\n");
+    while (!heads.empty())
+    {
+        size_t s = heads.top().second;
+        Spa &spa = spas[s];
+        heads.pop();
+
+        const FaultLogIndex::Entry &entry = spa.entries[spa.next++];
+        printf("%s,%u,%u,%02u:%02u,%u,%u,%u,%u\n", spa.name, entry.minute, entry.minute / 1440,
+               entry.minute % 1440 / 60, entry.minute % 60, entry.message_code, entry.set_temperature,
+               entry.sensor_a_temp, entry.sensor_b_temp);
+
+        if (spa.next < spa.entries.size())
+        {
+            heads.push(Head((uint32_t)spa.entries[spa.next].minute, s));
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,560 @@
+/**
+ * Property and fuzz harness for the wire protocol.
+ *
+ *   g++ -O1 -g -std=c++17 -fsanitize=address,undefined -I.. balboa_fuzz.cpp ../balboa_parser.cpp ../balboa_messages.cpp -o balboa_fuzz
+ *   ./balboa_fuzz [--seed N] [--iterations N] [--no-throughput] [--corpus DIR] [input...]
+ *
+ *   clang++ -O1 -g -std=c++17 -fsanitize=fuzzer,address,undefined -DBALBOA_LIBFUZZER -I.. \
+ *       balboa_fuzz.cpp ../balboa_parser.cpp ../balboa_messages.cpp -o balboa_fuzz_lf
+ *   ./balboa_fuzz_lf corpus/
+ *
+ * Every input goes through CheckStream(): it is fed to one parser in a single
+ * call and to another byte by byte, and both must see the same frames.  Every
+ * frame reported must occur in the input, bytes are accounted for (frames +
+ * dropped + at most BUFFER_SIZE pending), and after BUFFER_SIZE idle bytes a
+ * valid frame must come through whatever preceded it.  The input is copied
+ * to an exactly sized buffer so the sanitizers catch any overread.
+ *
+ * Without libFuzzer the program generates the inputs itself: random payloads
+ * for every message class must round-trip through Message, TxQueue and
+ * FrameParser, and biased garbage (frame marks, plausible lengths, spliced
+ * and corrupted frames) must keep the invariants.  It then times the parser
+ * on clean and hostile streams; per byte cost has to stay flat with stream
+ * length and within --max-ratio of clean traffic.  Build with -O2 and no
+ * sanitizers when the timings matter.  The exit code is 1 on any failure.
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "balboa_messages.hpp"
+#include "balboa_parser.hpp"
+#include "balboa_tools.hpp"
+
+using namespace balboa;
+
+namespace
+{
+    const uint8_t FRAME_MARK = 0x7e;
+    const uint8_t FRAME_OVERHEAD = 5; // length, type[3], crc
+
+#define CHECK(condition)                                                              \
+    do                                                                                \
+    {                                                                                 \
+        if (!(condition))                                                             \
+        {                                                                             \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            abort();                                                                  \
+        }                                                                             \
+    } while (0)
+
+    /** A frame as seen by a handler: type, payload and whether it was routed. */
+    struct Seen
+    {
+        bool routed;
+        uint8_t type[3];
+        std::vector<uint8_t> payload;
+
+        bool operator==(const Seen &other) const
+        {
+            return routed == other.routed && !memcmp(type, other.type, 3) && payload == other.payload;
+        }
+
+        /** The frame as it was on the wire, prefix to suffix. */
+        std::vector<uint8_t> Frame() const
+        {
+            std::vector<uint8_t> frame(payload.size() + FRAME_OVERHEAD + 2);
+            frame[0] = FRAME_MARK;
+            frame[1] = (uint8_t)(payload.size() + FRAME_OVERHEAD);
+            memcpy(&frame[2], type, 3);
+            std::copy(payload.begin(), payload.end(), frame.begin() + 5);
+            frame[frame.size() - 2] = CalcCRC(&frame[1], frame[1] - 1);
+            frame[frame.size() - 1] = FRAME_MARK;
+            return frame;
+        }
+    };
+
+    struct Recorder : MessageHandler
+    {
+        std::vector<Seen> seen;
+        size_t bytes = 0; // prefix to suffix, all frames
+
+        template <class MS>
+        void Record(const typename MS::data_type &data)
+        {
+            const uint8_t *payload = (const uint8_t *)&data;
+            seen.push_back(Seen{true, {MS::header_type::byte1, MS::header_type::byte2, MS::header_type::byte3},
+                                std::vector<uint8_t>(payload, payload + MS::length_type::length)});
+            bytes += MS::length_type::length + FRAME_OVERHEAD + 2;
+        }
+
+        void OnReadyToSend(const ReadyToSend::data_type &data) override { Record<ReadyToSend>(data); }
+        void OnStatus(const Status::data_type &data) override { Record<Status>(data); }
+        void OnFilterCycles(const FilterCyclesResponse::data_type &data) override { Record<FilterCyclesResponse>(data); }
+        void OnInformation(const InformationResponse::data_type &data) override { Record<InformationResponse>(data); }
+        void OnFaultLog(const FaultLogResponse::data_type &data) override { Record<FaultLogResponse>(data); }
+        void OnControlConfig2(const ControlConfig2Response::data_type &data) override { Record<ControlConfig2Response>(data); }
+        void OnConfig(const ConfigResponse::data_type &data) override { Record<ConfigResponse>(data); }
+        void OnSetTempRange(const SetTempRange::data_type &data) override { Record<SetTempRange>(data); }
+        void OnUnhandled(const uint8_t *frame) override
+        {
+            CHECK(frame[0] >= FRAME_OVERHEAD && frame[0] + 2 <= FrameParser::BUFFER_SIZE);
+            seen.push_back(Seen{false, {frame[1], frame[2], frame[3]},
+                                std::vector<uint8_t>(frame + 4, frame + 4 + frame[0] - FRAME_OVERHEAD)});
+            bytes += frame[0] + 2;
+        }
+    };
+
+    template <class MS>
+    std::vector<uint8_t> Encode(const typename MS::data_type &data)
+    {
+        Message<MS> message;
+        memcpy(&message.data, &data, MS::length_type::length);
+        message.SetCRC();
+        std::vector<uint8_t> frame(MS::length_type::length + FRAME_OVERHEAD + 2);
+        CHECK(message.Write(frame.data()) == frame.size());
+        return frame;
+    }
+
+    /** A Status frame no garbage can swallow, used to probe resync. */
+    std::vector<uint8_t> Probe()
+    {
+        Status::data_type status = {};
+        status.hour = 12;
+        status.minute = 34;
+        status.current_temp = 100;
+        return Encode<Status>(status);
+    }
+
+    void CheckStream(const uint8_t *input, size_t size)
+    {
+        // Exactly sized, so any read past the end is a sanitizer report.
+        std::vector<uint8_t> data(input, input + size);
+        const uint8_t *begin = size ? data.data() : nullptr;
+
+        FrameParser whole;
+        Recorder seen_whole;
+        size_t found = whole.Feed(begin, size, seen_whole);
+        CHECK(found == seen_whole.seen.size());
+        CHECK(whole.frames() == found);
+
+        // Chunking must not matter.
+        FrameParser split;
+        Recorder seen_split;
+        for (size_t i = 0; i < size; i++)
+        {
+            split.Feed(&data[i], 1, seen_split);
+        }
+        CHECK(seen_split.seen == seen_whole.seen);
+        CHECK(split.dropped() == whole.dropped());
+
+        // Nothing is made up, nothing is lost.
+        for (const Seen &seen : seen_whole.seen)
+        {
+            std::vector<uint8_t> frame = seen.Frame();
+            CHECK(std::search(data.begin(), data.end(), frame.begin(), frame.end()) != data.end());
+        }
+        size_t accounted = seen_whole.bytes + whole.dropped();
+        CHECK(accounted <= size && size - accounted < FrameParser::BUFFER_SIZE);
+
+        // Resync: after BUFFER_SIZE idle bytes the next frame must come through.
+        uint8_t idle[FrameParser::BUFFER_SIZE] = {};
+        std::vector<uint8_t> probe = Probe();
+        whole.Feed(idle, sizeof(idle), seen_whole);
+        size_t before = seen_whole.seen.size();
+        CHECK(whole.Feed(probe.data(), probe.size(), seen_whole) == 1);
+        CHECK(seen_whole.seen.size() == before + 1 && seen_whole.seen.back().Frame() == probe);
+    }
+
+    /*****************************************************************
+    **************************GENERATORS******************************
+    ******************************************************************/
+
+    /** Random payload for MS; must come back unchanged whatever precedes it. */
+    template <class MS, bool ROUTED>
+    void RoundTrip(std::mt19937 &rng)
+    {
+        typename MS::data_type data;
+        uint8_t *payload = (uint8_t *)&data;
+        for (uint8_t i = 0; i < MS::length_type::length; i++)
+        {
+            payload[i] = (uint8_t)rng();
+        }
+        std::vector<uint8_t> frame = Encode<MS>(data);
+
+        Seen expected{ROUTED, {MS::header_type::byte1, MS::header_type::byte2, MS::header_type::byte3},
+                      std::vector<uint8_t>(payload, payload + MS::length_type::length)};
+        CHECK(expected.Frame() == frame);
+
+        // The TX path must build the same bytes.
+        if (frame.size() <= TxQueue::FRAME_SIZE)
+        {
+            TxQueue tx;
+            CHECK(tx.Push<MS>(data));
+            uint8_t size;
+            const uint8_t *queued = tx.Front(size);
+            CHECK(queued && size == frame.size() && !memcmp(queued, frame.data(), size));
+        }
+
+        // Frames longer than the parser buffer (SetWiFiSettingsRequest) are
+        // TX only and must be dropped, not cut short.
+        const bool fits = frame.size() <= FrameParser::BUFFER_SIZE;
+
+        // Alone, in random chunks.
+        FrameParser parser;
+        Recorder recorder;
+        for (size_t pos = 0; pos < frame.size();)
+        {
+            size_t chunk = std::min<size_t>(1 + rng() % 8, frame.size() - pos);
+            parser.Feed(&frame[pos], chunk, recorder);
+            pos += chunk;
+        }
+        if (fits)
+        {
+            CHECK(recorder.seen.size() == 1 && recorder.seen[0] == expected);
+            CHECK(parser.dropped() == 0);
+        }
+        else
+        {
+            CHECK(std::find(recorder.seen.begin(), recorder.seen.end(), expected) == recorder.seen.end());
+        }
+
+        // After garbage and an idle gap.
+        std::vector<uint8_t> stream;
+        for (unsigned n = rng() % 64; n; n--)
+        {
+            stream.push_back(rng() % 4 ? (uint8_t)rng() : FRAME_MARK);
+        }
+        stream.insert(stream.end(), FrameParser::BUFFER_SIZE, 0);
+        stream.insert(stream.end(), frame.begin(), frame.end());
+        CheckStream(stream.data(), stream.size());
+
+        FrameParser after;
+        Recorder tail;
+        after.Feed(stream.data(), stream.size(), tail);
+        CHECK(fits ? !tail.seen.empty() && tail.seen.back() == expected
+                   : std::find(tail.seen.begin(), tail.seen.end(), expected) == tail.seen.end());
+    }
+
+    void RoundTripAll(std::mt19937 &rng)
+    {
+        RoundTrip<ConfigRequest, false>(rng);
+        RoundTrip<ToggleItemRequest, false>(rng);
+        RoundTrip<SetTempRequest, false>(rng);
+        RoundTrip<SetTimeRequest, false>(rng);
+        RoundTrip<FilterConfigRequest, false>(rng);
+        RoundTrip<SettingsRequest, false>(rng);
+        RoundTrip<SetFilterConfigRequest, false>(rng);
+        RoundTrip<SetTempScaleRequest, false>(rng);
+        RoundTrip<SetWiFiSettingsRequest, false>(rng);
+        RoundTrip<ReadyToSend, true>(rng);
+        RoundTrip<Status, true>(rng);
+        RoundTrip<FilterCyclesResponse, true>(rng);
+        RoundTrip<InformationResponse, true>(rng);
+        RoundTrip<FaultLogResponse, true>(rng);
+        RoundTrip<ControlConfig2Response, true>(rng);
+        RoundTrip<ConfigResponse, true>(rng);
+        RoundTrip<SetTempRange, true>(rng);
+    }
+
+    template <class MS>
+    void AppendFrame(std::mt19937 &rng, std::vector<uint8_t> &stream)
+    {
+        typename MS::data_type data;
+        for (uint8_t i = 0; i < MS::length_type::length; i++)
+        {
+            ((uint8_t *)&data)[i] = (uint8_t)rng();
+        }
+        std::vector<uint8_t> frame = Encode<MS>(data);
+        stream.insert(stream.end(), frame.begin(), frame.end());
+    }
+
+    /**
+     * Garbage biased towards what hurts a framer: frame marks, lengths the
+     * parser will wait for, valid frames, and valid frames with one byte
+     * flipped or cut short.
+     */
+    std::vector<uint8_t> Garbage(std::mt19937 &rng, size_t size)
+    {
+        std::vector<uint8_t> stream;
+        while (stream.size() < size)
+        {
+            switch (rng() % 6)
+            {
+            case 0:
+                stream.push_back((uint8_t)rng());
+                break;
+            case 1:
+                stream.push_back(FRAME_MARK);
+                stream.push_back((uint8_t)(FRAME_OVERHEAD + rng() % (FrameParser::BUFFER_SIZE - FRAME_OVERHEAD)));
+                break;
+            case 2:
+                stream.push_back(FRAME_MARK);
+                break;
+            case 3:
+                AppendFrame<Status>(rng, stream);
+                break;
+            case 4:
+            {
+                size_t start = stream.size();
+                AppendFrame<FaultLogResponse>(rng, stream);
+                stream[start + 1 + rng() % (stream.size() - start - 1)] ^= (uint8_t)(1 + rng() % 255);
+                break;
+            }
+            default:
+            {
+                size_t start = stream.size();
+                AppendFrame<ReadyToSend>(rng, stream);
+                stream.resize(start + 1 + rng() % (stream.size() - start - 1));
+                break;
+            }
+            }
+        }
+        return stream;
+    }
+
+    /*****************************************************************
+    **************************THROUGHPUT******************************
+    ******************************************************************/
+
+    struct Counter : MessageHandler
+    {
+        uint32_t count = 0;
+        void OnStatus(const Status::data_type &) override { count++; }
+        void OnReadyToSend(const ReadyToSend::data_type &) override { count++; }
+        void OnUnhandled(const uint8_t *) override { count++; }
+    };
+
+    /** Fastest of five runs of at least 20 ms each, in ns per input byte. */
+    double NsPerByte(const std::vector<uint8_t> &stream)
+    {
+        double best = 1e300;
+        for (int round = 0; round < 5; round++)
+        {
+            size_t bytes = 0;
+            Counter counter;
+            auto start = std::chrono::steady_clock::now();
+            std::chrono::duration<double, std::nano> elapsed{};
+            do
+            {
+                FrameParser parser;
+                for (size_t pos = 0; pos < stream.size(); pos += 64)
+                {
+                    parser.Feed(&stream[pos], std::min<size_t>(64, stream.size() - pos), counter);
+                }
+                bytes += stream.size();
+                elapsed = std::chrono::steady_clock::now() - start;
+            } while (elapsed.count() < 20e6);
+            best = std::min(best, elapsed.count() / bytes);
+        }
+        return best;
+    }
+
+    /**
+     * Prints ns/byte for every stream at two lengths.  Fails if a stream gets
+     * more expensive per byte as it grows, or if it costs more than
+     * `max_ratio` times clean traffic.
+     */
+    bool Throughput(std::mt19937 &rng, double max_ratio)
+    {
+        const size_t SHORT = 16 * 1024;
+        const size_t LONG = 1024 * 1024;
+
+        struct Case
+        {
+            const char *name;
+            std::vector<uint8_t> (*make)(std::mt19937 &, size_t);
+        };
+        static const Case CASES[] = {
+            {"clean", [](std::mt19937 &rng, size_t size) {
+                 std::vector<uint8_t> stream;
+                 while (stream.size() < size)
+                 {
+                     if (rng() % 2)
+                     {
+                         AppendFrame<Status>(rng, stream);
+                     }
+                     else
+                     {
+                         AppendFrame<ReadyToSend>(rng, stream);
+                     }
+                 }
+                 return stream;
+             }},
+            {"random", [](std::mt19937 &rng, size_t size) {
+                 std::vector<uint8_t> stream(size);
+                 for (uint8_t &byte : stream)
+                 {
+                     byte = (uint8_t)rng();
+                 }
+                 return stream;
+             }},
+            // Every candidate waits for the longest frame, then fails.
+            {"marks", [](std::mt19937 &, size_t size) {
+                 std::vector<uint8_t> stream(size, FRAME_MARK);
+                 for (size_t i = 1; i < size; i += 2)
+                 {
+                     stream[i] = FrameParser::BUFFER_SIZE - 2;
+                 }
+                 return stream;
+             }},
+            {"biased", &Garbage},
+        };
+
+        bool ok = true;
+        double clean = 0;
+        printf("%-10s %12s %12s\n", "stream", "16K ns/B", "1M ns/B");
+        for (const Case &test : CASES)
+        {
+            double small = NsPerByte(test.make(rng, SHORT));
+            double large = NsPerByte(test.make(rng, LONG));
+            printf("%-10s %12.2f %12.2f\n", test.name, small, large);
+
+            clean = clean ? clean : large;
+            if (large > 2 * small)
+            {
+                fprintf(stderr, "%s: cost per byte grows with length (%.2f -> %.2f ns)\n", test.name, small, large);
+                ok = false;
+            }
+            if (large > max_ratio * clean)
+            {
+                fprintf(stderr, "%s: %.1fx clean traffic, limit %.1fx\n", test.name, large / clean, max_ratio);
+                ok = false;
+            }
+        }
+        return ok;
+    }
+
+    /*****************************************************************
+    **************************DRIVER**********************************
+    ******************************************************************/
+
+    bool WriteFile(const std::string &path, const std::vector<uint8_t> &data)
+    {
+        FILE *file = fopen(path.c_str(), "wb");
+        if (!file)
+        {
+            perror(path.c_str());
+            return false;
+        }
+        fwrite(data.data(), 1, data.size(), file);
+        fclose(file);
+        return true;
+    }
+
+    /** A small seed corpus for libFuzzer: clean, biased and probe streams. */
+    int Corpus(const char *directory, std::mt19937 &rng)
+    {
+        std::vector<uint8_t> clean;
+        AppendFrame<Status>(rng, clean);
+        AppendFrame<ReadyToSend>(rng, clean);
+        AppendFrame<FilterCyclesResponse>(rng, clean);
+        AppendFrame<FaultLogResponse>(rng, clean);
+        AppendFrame<InformationResponse>(rng, clean);
+        AppendFrame<SettingsRequest>(rng, clean);
+
+        std::string prefix = std::string(directory) + "/seed_";
+        bool ok = WriteFile(prefix + "clean", clean) && WriteFile(prefix + "probe", Probe());
+        for (int i = 0; ok && i < 8; i++)
+        {
+            ok = WriteFile(prefix + "biased_" + std::to_string(i), Garbage(rng, 64 + rng() % 256));
+        }
+        return ok ? 0 : 1;
+    }
+
+    int Usage(const char *argv0)
+    {
+        fprintf(stderr,
+                "usage: %s [--seed N] [--iterations N] [--max-ratio R] [--no-throughput] [input...]\n"
+                "       %s --corpus DIR\n",
+                argv0, argv0);
+        return 2;
+    }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    CheckStream(data, size);
+    return 0;
+}
+
+#ifndef BALBOA_LIBFUZZER
+int main(int argc, char **argv)
+{
+    unsigned seed = 1;
+    unsigned iterations = 2000;
+    double max_ratio = 8;
+    bool throughput = true;
+    const char *corpus = nullptr;
+    std::vector<const char *> inputs;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--seed") && i + 1 < argc)
+        {
+            seed = (unsigned)strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "--iterations") && i + 1 < argc)
+        {
+            iterations = (unsigned)strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "--max-ratio") && i + 1 < argc)
+        {
+            max_ratio = atof(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--no-throughput"))
+        {
+            throughput = false;
+        }
+        else if (!strcmp(argv[i], "--corpus") && i + 1 < argc)
+        {
+            corpus = argv[++i];
+        }
+        else if (argv[i][0] == '-')
+        {
+            return Usage(argv[0]);
+        }
+        else
+        {
+            inputs.push_back(argv[i]);
+        }
+    }
+
+    std::mt19937 rng(seed);
+    if (corpus)
+    {
+        return Corpus(corpus, rng);
+    }
+
+    // Given inputs (e.g. a libFuzzer crash) are replayed and nothing else.
+    if (!inputs.empty())
+    {
+        for (const char *path : inputs)
+        {
+            std::vector<uint8_t> data;
+            if (!LoadFile(path, data))
+            {
+                return 1;
+            }
+            CheckStream(data.data(), data.size());
+            printf("%s: ok\n", path);
+        }
+        return 0;
+    }
+
+    for (unsigned i = 0; i < iterations; i++)
+    {
+        RoundTripAll(rng);
+        std::vector<uint8_t> garbage = Garbage(rng, rng() % 512);
+        CheckStream(garbage.data(), garbage.size());
+    }
+    printf("%u iterations, seed %u: round trips and parser invariants hold\n", iterations, seed);
+
+    return throughput && !Throughput(rng, max_ratio) ? 1 : 0;
+}
+#endif
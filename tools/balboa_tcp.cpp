@@ -0,0 +1,315 @@
+/**
+ * Local stand-in for the Balboa Wi-Fi module, and a client for it.
+ *
+ *   g++ -O2 -std=c++17 -I.. balboa_tcp.cpp ../balboa_transport.cpp ../balboa_parser.cpp ../balboa_messages.cpp -o balboa_tcp
+ *   ./balboa_tcp serve [--port 4257] [--capture raw.bin]
+ *   ./balboa_tcp client 127.0.0.1 [--port 4257] [--seconds 5]
+ *
+ * The server sends a Status every second (or replays the frames of a raw
+ * capture), prints every frame it receives and answers a filter cycles
+ * request.  The client goes through TcpTransport exactly like BalboaSpa.
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "balboa_messages.hpp"
+#include "balboa_parser.hpp"
+#include "balboa_tools.hpp"
+#include "balboa_transport.hpp"
+
+using namespace balboa;
+
+namespace
+{
+
+    uint64_t NowMs()
+    {
+        using namespace std::chrono;
+        return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+    }
+
+    void Print(const char *what, const uint8_t *frame)
+    {
+        printf("%s %02x %02x %02x %02x:", what, frame[0], frame[1], frame[2], frame[3]);
+        for (uint8_t i = 4; i < frame[0] - 1; i++)
+        {
+            printf(" %02x", frame[i]);
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+
+    template <class MS>
+    std::vector<uint8_t> Frame(const typename MS::data_type &data)
+    {
+        Message<MS> message;
+        message.data = data;
+        message.SetCRC();
+        std::vector<uint8_t> frame(MS::length_type::length + 7);
+        message.Write(frame.data());
+        return frame;
+    }
+
+    /** Splits a raw capture into its valid frames. */
+    std::vector<std::vector<uint8_t>> LoadFrames(const char *path)
+    {
+        std::vector<std::vector<uint8_t>> frames;
+        std::vector<uint8_t> data;
+        if (!LoadFile(path, data))
+        {
+            return frames;
+        }
+        const uint8_t *end = data.data() + data.size();
+        for (const uint8_t *p = data.data(); (p = FindFrame(p, end)); p += p[1] + 2)
+        {
+            frames.emplace_back(p, p + p[1] + 2);
+        }
+        return frames;
+    }
+
+    struct ServerHandler : MessageHandler
+    {
+        std::vector<uint8_t> reply;
+
+        void OnUnhandled(const uint8_t *frame) override
+        {
+            Print("recv", frame);
+
+            SettingsRequest::data_type filters;
+            SettingsRequest::SetSettingsType(SettingsRequest::FILTER_CYCLES_REQUEST, filters);
+            if (frame[0] == SettingsRequest::length_type::length + 5 &&
+                frame[3] == SettingsRequest::header_type::byte3 && !memcmp(frame + 4, filters.payload, 3))
+            {
+                FilterCyclesResponse::data_type data = {};
+                data.filter1_start_hour = 20;
+                data.filter1_duration_hours = 2;
+                reply = Frame<FilterCyclesResponse>(data);
+            }
+        }
+    };
+
+    void Serve(int client, const std::vector<std::vector<uint8_t>> &capture)
+    {
+        int one = 1;
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        FrameParser parser;
+        ServerHandler handler;
+        Status::data_type status = {};
+        size_t next = 0;
+        uint64_t due = NowMs();
+
+        for (;;)
+        {
+            pollfd fd = {client, POLLIN, 0};
+            int wait = (int)(due > NowMs() ? due - NowMs() : 0);
+            if (poll(&fd, 1, wait) < 0)
+            {
+                return;
+            }
+
+            if (fd.revents & (POLLIN | POLLHUP | POLLERR))
+            {
+                uint8_t data[512];
+                ssize_t got = recv(client, data, sizeof(data), 0);
+                if (got <= 0)
+                {
+                    return;
+                }
+                parser.Feed(data, (size_t)got, handler);
+                if (!handler.reply.empty())
+                {
+                    send(client, handler.reply.data(), handler.reply.size(), MSG_NOSIGNAL);
+                    handler.reply.clear();
+                }
+            }
+
+            if (NowMs() < due)
+            {
+                continue;
+            }
+
+            std::vector<uint8_t> frame;
+            if (!capture.empty())
+            {
+                frame = capture[next++ % capture.size()];
+                due += 10;
+            }
+            else
+            {
+                uint64_t minutes = NowMs() / 60000;
+                status.hour = (uint8_t)(minutes / 60 % 24);
+                status.minute = (uint8_t)(minutes % 60);
+                status.current_temp = 100;
+                status.set_temp = 102;
+                frame = Frame<Status>(status);
+                due += 1000;
+            }
+            if (send(client, frame.data(), frame.size(), MSG_NOSIGNAL) < 0)
+            {
+                return;
+            }
+        }
+    }
+
+    int Server(uint16_t port, const char *capture_path)
+    {
+        std::vector<std::vector<uint8_t>> capture;
+        if (capture_path)
+        {
+            capture = LoadFrames(capture_path);
+            printf("%zu frames from %s\n", capture.size(), capture_path);
+        }
+
+        int server = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (server < 0 || bind(server, (sockaddr *)&address, sizeof(address)) < 0 || listen(server, 1) < 0)
+        {
+            perror("listen");
+            return 1;
+        }
+        printf("listening on 127.0.0.1:%u\n", port);
+        fflush(stdout);
+
+        for (;;)
+        {
+            int client = accept(server, nullptr, nullptr);
+            if (client < 0)
+            {
+                continue;
+            }
+            printf("client connected\n");
+            Serve(client, capture);
+            close(client);
+            printf("client gone\n");
+            fflush(stdout);
+        }
+    }
+
+    struct ClientHandler : MessageHandler
+    {
+        void OnStatus(const Status::data_type &data) override
+        {
+            printf("status %02u:%02u temp %u set %u heating %u\n", data.hour, data.minute,
+                   data.current_temp, data.set_temp, data.heating);
+            fflush(stdout);
+        }
+        void OnFilterCycles(const FilterCyclesResponse::data_type &data) override
+        {
+            printf("filter1 %02u:%02u for %uh%02u\n", data.filter1_start_hour, data.filter1_start_minute,
+                   data.filter1_duration_hours, data.filter1_duration_minutes);
+            fflush(stdout);
+        }
+        void OnUnhandled(const uint8_t *frame) override { Print("frame", frame); }
+    };
+
+    int Client(const char *address, uint16_t port, unsigned seconds)
+    {
+        static TcpTransport transport;
+        if (!transport.Connect(address, port))
+        {
+            fprintf(stderr, "cannot connect to %s:%u\n", address, port);
+            return 1;
+        }
+
+        TxQueue tx;
+        FrameParser parser;
+        ClientHandler handler;
+        ConfigRequest::data_type config;
+        SettingsRequest::data_type filters;
+        SettingsRequest::SetSettingsType(SettingsRequest::FILTER_CYCLES_REQUEST, filters);
+        tx.Push<ConfigRequest>(config);
+        tx.Push<SettingsRequest>(filters);
+
+        uint64_t end = NowMs() + seconds * 1000;
+        while (NowMs() < end)
+        {
+            uint8_t chunk[64];
+            size_t length;
+            while ((length = transport.Read(chunk, sizeof(chunk))) > 0)
+            {
+                parser.Feed(chunk, length, handler);
+            }
+
+            uint8_t size;
+            const uint8_t *frame;
+            while (transport.connected() && (frame = tx.Front(size)) && transport.Write(frame, size))
+            {
+                tx.Pop();
+            }
+            transport.Flush();
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(16));
+        }
+
+        printf("%u frames, %u bytes dropped\n", parser.frames(), parser.dropped());
+        return parser.frames() ? 0 : 1;
+    }
+
+    int Usage(const char *argv0)
+    {
+        fprintf(stderr,
+                "usage: %s serve [--port N] [--capture raw.bin]\n"
+                "       %s client ADDRESS [--port N] [--seconds N]\n",
+                argv0, argv0);
+        return 2;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    signal(SIGPIPE, SIG_IGN);
+    if (argc < 2)
+    {
+        return Usage(argv[0]);
+    }
+
+    bool serve = !strcmp(argv[1], "serve");
+    if (!serve && (strcmp(argv[1], "client") || argc < 3))
+    {
+        return Usage(argv[0]);
+    }
+
+    uint16_t port = TcpTransport::DEFAULT_PORT;
+    unsigned seconds = 5;
+    const char *capture = nullptr;
+    for (int i = serve ? 2 : 3; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--port") && i + 1 < argc)
+        {
+            port = (uint16_t)atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--capture") && i + 1 < argc && serve)
+        {
+            capture = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--seconds") && i + 1 < argc && !serve)
+        {
+            seconds = (unsigned)atoi(argv[++i]);
+        }
+        else
+        {
+            return Usage(argv[0]);
+        }
+    }
+
+    return serve ? Server(port, capture) : Client(argv[2], port, seconds);
+}
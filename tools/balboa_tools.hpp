@@ -0,0 +1,30 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+
+/**
+ * Host only helpers shared by the tools.  Framing rules are not here but in
+ * FindFrame() next to CalcCRC(), where the firmware sees them too.
+ */
+namespace balboa
+{
+    /** Appends the file at `path` to `data` (any byte vector); false after perror() if unreadable. */
+    template <class Bytes>
+    bool LoadFile(const char *path, Bytes &data)
+    {
+        FILE *file = fopen(path, "rb");
+        if (!file)
+        {
+            perror(path);
+            return false;
+        }
+        uint8_t chunk[65536];
+        size_t n;
+        while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0)
+        {
+            data.insert(data.end(), chunk, chunk + n);
+        }
+        fclose(file);
+        return true;
+    }
+};
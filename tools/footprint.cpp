@@ -0,0 +1,27 @@
+/**
+ * Instantiates Message<MS> for every message class so footprint.sh can
+ * report what each instantiation costs.  Not meant to be run.
+ */
+#include "balboa_messages.hpp"
+#include "balboa_parser.hpp"
+
+namespace balboa
+{
+    template struct Message<ConfigRequest>;
+    template struct Message<ToggleItemRequest>;
+    template struct Message<SetTempRequest>;
+    template struct Message<SetTimeRequest>;
+    template struct Message<FilterConfigRequest>;
+    template struct Message<SettingsRequest>;
+    template struct Message<SetFilterConfigRequest>;
+    template struct Message<SetTempScaleRequest>;
+    template struct Message<SetWiFiSettingsRequest>;
+    template struct Message<ReadyToSend>;
+    template struct Message<Status>;
+    template struct Message<FilterCyclesResponse>;
+    template struct Message<InformationResponse>;
+    template struct Message<FaultLogResponse>;
+    template struct Message<ControlConfig2Response>;
+    template struct Message<ConfigResponse>;
+    template struct Message<SetTempRange>;
+};
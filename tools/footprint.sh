@@ -0,0 +1,49 @@
+#!/bin/sh
+# Per-symbol size report for the protocol layer.
+#
+#   tools/footprint.sh                 print the report
+#   tools/footprint.sh --check         compare against tools/footprint.txt
+#   tools/footprint.sh --update        rewrite tools/footprint.txt
+#
+# The stored baseline is from a host g++ build; compare like with like.
+#
+# CXX and CXXFLAGS can point at a cross compiler, e.g.
+#   CXX=xtensa-esp32-elf-g++ tools/footprint.sh
+set -e
+
+cd "$(dirname "$0")/.."
+CXX=${CXX:-g++}
+CXXFLAGS=${CXXFLAGS:--Os -std=gnu++17 -ffunction-sections -fdata-sections}
+NM=${NM:-$(echo "$CXX" | sed 's/g++$/nm/; s/clang++$/llvm-nm/')}
+BASELINE=tools/footprint.txt
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+for src in balboa_messages.cpp balboa_parser.cpp tools/footprint.cpp; do
+    $CXX $CXXFLAGS -I. -c "$src" -o "$OUT/$(basename "$src" .cpp).o"
+done
+
+# size symbol, largest first, with a total at the end.  Complete and base
+# object constructors demangle to the same name and share code, count once.
+$NM -C -S -t d --size-sort "$OUT"/*.o |
+    awk '$3 ~ /^[TtWwRrDdBbVv]$/ { size = $2 + 0; $1 = $2 = $3 = ""; sub(/^ +/, "");
+                                     if (!seen[$0]++) printf "%6d %s\n", size, $0 }' |
+    sort -k1,1nr -s > "$OUT/symbols.txt"
+awk '{ total += $1 } END { printf "%6d TOTAL\n", total }' "$OUT/symbols.txt" |
+    cat "$OUT/symbols.txt" - > "$OUT/report.txt"
+
+case "$1" in
+--update)
+    cp "$OUT/report.txt" "$BASELINE"
+    ;;
+--check)
+    old=$(awk '$2 == "TOTAL" { print $1 }' "$BASELINE")
+    new=$(awk '$2 == "TOTAL" { print $1 }' "$OUT/report.txt")
+    diff -u "$BASELINE" "$OUT/report.txt" || true
+    echo "total: $old -> $new bytes"
+    [ "$new" -le "$old" ]
+    ;;
+*)
+    cat "$OUT/report.txt"
+    ;;
+esac